@@ -0,0 +1,214 @@
+#ifndef __BINDING_DEFINED__
+#define __BINDING_DEFINED__
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <type_traits>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+// Binding of records in the source straight into C++ structs. A type
+// describes its fields by specialising schema<>:
+//
+//	struct point { int x, y, z; };
+//
+//	template<> struct schema<point> {
+//		static auto fields() {
+//			return make_tuple(bind_field("x", &point::x),
+//				bind_field("y", &point::y), bind_field("z", &point::z));
+//		}
+//	};
+//
+// bind_records(parser, "point", points) then fills a vector<point> from
+// every point = { x = "1" y = "0" z = "0" } block while the source is
+// tokenized; no token list and no nodes are built. All fields must be
+// given once, other names or nested blocks inside a record are errors.
+
+template<typename T>
+struct schema;
+
+template<typename T, typename M>
+struct field_binding
+{
+	const char* name;
+	M T::* member;
+};
+
+template<typename T, typename M>
+field_binding<T, M> bind_field(const char* name, M T::* member)
+{
+	return field_binding<T, M>{ name, member };
+}
+
+// conversion of a token value into the type of a field, false if the
+// value does not fit; integers are decimal, or hex with 0x (0xFF)
+
+// a leading zero does not make a number octal
+inline int integer_base(const string& s)
+{
+	size_t i = (!s.empty() && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+	return (s.size() > i + 1 && s[i] == '0' && (s[i + 1] == 'x' || s[i + 1] == 'X')) ? 16 : 10;
+}
+
+template<typename M>
+typename enable_if<is_integral<M>::value && is_signed<M>::value, bool>::type
+bind_value(const string& s, M& member)
+{
+	char* end;
+	errno = 0;
+	long long v = strtoll(s.c_str(), &end, integer_base(s));
+	member = (M)v;
+	return !s.empty() && *end == '\0' && errno != ERANGE && (long long)member == v;
+}
+
+template<typename M>
+typename enable_if<is_integral<M>::value && !is_signed<M>::value, bool>::type
+bind_value(const string& s, M& member)
+{
+	char* end;
+	errno = 0;
+	unsigned long long v = strtoull(s.c_str(), &end, integer_base(s));
+	member = (M)v;
+	return !s.empty() && s[0] != '-' && *end == '\0' && errno != ERANGE && (unsigned long long)member == v;
+}
+
+template<typename M>
+typename enable_if<is_floating_point<M>::value, bool>::type
+bind_value(const string& s, M& member)
+{
+	char* end;
+	member = (M)strtod(s.c_str(), &end);
+	return !s.empty() && *end == '\0';
+}
+
+inline bool bind_value(const string& s, string& member)
+{
+	member = s;
+	return true;
+}
+
+// index of the field called name, or -1; the value is stored in the
+// record and ok tells if it could be converted
+template<size_t I = 0, typename T, typename... F>
+typename enable_if<(I == sizeof...(F)), int>::type
+bind_field_value(T&, const tuple<F...>&, string_view, const string&, bool&)
+{
+	return -1;
+}
+
+template<size_t I = 0, typename T, typename... F>
+typename enable_if<(I < sizeof...(F)), int>::type
+bind_field_value(T& record, const tuple<F...>& fields, string_view name, const string& value, bool& ok)
+{
+	if (name == get<I>(fields).name) {
+		ok = bind_value(value, record.*(get<I>(fields).member));
+		return (int)I;
+	}
+	return bind_field_value<I + 1>(record, fields, name, value, ok);
+}
+
+template<size_t I = 0, typename... F>
+typename enable_if<(I == sizeof...(F)), const char*>::type
+field_name(const tuple<F...>&, size_t)
+{
+	return "";
+}
+
+template<size_t I = 0, typename... F>
+typename enable_if<(I < sizeof...(F)), const char*>::type
+field_name(const tuple<F...>& fields, size_t index)
+{
+	return index == I ? get<I>(fields).name : field_name<I + 1>(fields, index);
+}
+
+// fill records from all blocks named record_name, false on the first error
+template<typename T>
+bool bind_records(token_parser& parser, const string& record_name, vector<T>& records)
+{
+	const auto fields = schema<T>::fields();
+	const size_t field_count = tuple_size<decltype(fields)>::value;
+	static_assert(field_count <= 64, "at most 64 fields can be bound");
+	const uint64_t all_fields = field_count == 64 ? ~0ULL : (1ULL << field_count) - 1;
+
+	shared_ptr<base_token> tok;
+	string previous;	// the symbol before the current token
+	while ((tok = parser.read_token()) != nullptr && tok->type() != base_token::t_eof)
+	{
+		string_view val = tok->get_value();
+		if (tok->type() == base_token::t_symbol) {
+			previous = val;
+			continue;
+		}
+		// only "record_name = {" starts a record
+		if (!(tok->type() == base_token::t_punctuation && val == "=" && previous == record_name)) {
+			previous.clear();
+			continue;
+		}
+		previous.clear();
+		tok = parser.read_token();
+		if (tok == nullptr)
+			return false;
+		if (tok->type() != base_token::t_punctuation || tok->get_value() != "{")
+			continue;
+
+		size_t record_pos = tok->get_pos();
+		T record = T();
+		uint64_t seen = 0;
+		while (true) {
+			shared_ptr<base_token> name = parser.read_token();
+			if (name == nullptr)
+				return false;
+			if (name->type() == base_token::t_punctuation && name->get_value() == "}")
+				break;
+			shared_ptr<base_token> assign = parser.read_token();
+			shared_ptr<base_token> value = assign != nullptr ? parser.read_token() : nullptr;
+			if (value == nullptr)
+				return false;
+
+			if (name->type() != base_token::t_symbol || assign->get_value() != "="
+				|| (value->type() != base_token::t_literal && value->type() != base_token::t_integer
+					&& value->type() != base_token::t_const_literal)) {
+				cout << "At " << parser.location(name->get_pos()) << ": Expected 'field = value' in " << record_name << endl;
+				return false;
+			}
+
+			bool ok = false;
+			int index = bind_field_value(record, fields, name->get_value(), string(value->get_value()), ok);
+			if (index < 0) {
+				cout << "At " << parser.location(name->get_pos()) << ": Unexpected field '" << name->get_value() << "' in " << record_name << endl;
+				return false;
+			}
+			if (!ok) {
+				cout << "At " << parser.location(value->get_pos()) << ": Invalid value '" << value->get_value() << "' for " << name->get_value() << endl;
+				return false;
+			}
+			if (seen & (1ULL << index)) {
+				cout << "At " << parser.location(name->get_pos()) << ": Field '" << name->get_value() << "' given twice in " << record_name << endl;
+				return false;
+			}
+			seen |= 1ULL << index;
+		}
+
+		if (seen != all_fields) {
+			size_t missing = 0;
+			while (seen & (1ULL << missing))
+				++missing;
+			cout << "At " << parser.location(record_pos) << ": Missing field '" << field_name(fields, missing) << "' in " << record_name << endl;
+			return false;
+		}
+		records.push_back(record);
+	}
+	return tok != nullptr;
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+#include "Cache.h"
+#include "Emitter.h"
+
+static const char cache_magic[8] = { 'T', 'P', 'C', 'A', 'C', 'H', 'E', '1' };
+static const uint32_t no_parent = 0xFFFFFFFF;
+
+// kinds of records following the header
+enum { r_node = 0, r_shared = 1, r_end = 2 };
+
+struct cache_header
+{
+	char magic[8];
+	uint64_t key;
+	uint64_t source_size;
+	uint32_t options;
+	uint32_t reserved;
+};
+
+// the content hash follows xxHash64: four independent lanes of 8 bytes, so
+// the multiplications of one step do not wait for each other
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotate_left(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+static inline uint64_t read64(const char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t read32(const char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t v)
+{
+	acc += v * prime2;
+	return rotate_left(acc, 31) * prime1;
+}
+
+static inline uint64_t hash_merge(uint64_t h, uint64_t lane)
+{
+	h ^= hash_round(0, lane);
+	return h * prime1 + prime4;
+}
+
+uint64_t parse_cache::content_hash(const char* data, size_t size)
+{
+	const char* p = data;
+	const char* end = data + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v1 = prime1 + prime2, v2 = prime2, v3 = 0, v4 = 0 - prime1;
+		const char* limit = end - 32;
+		do {
+			v1 = hash_round(v1, read64(p));
+			v2 = hash_round(v2, read64(p + 8));
+			v3 = hash_round(v3, read64(p + 16));
+			v4 = hash_round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+		h = hash_merge(h, v1);
+		h = hash_merge(h, v2);
+		h = hash_merge(h, v3);
+		h = hash_merge(h, v4);
+	}
+	else
+		h = prime5;
+	h += size;
+
+	for (; p + 8 <= end; p += 8)
+		h = rotate_left(h ^ hash_round(0, read64(p)), 27) * prime1 + prime4;
+	if (p + 4 <= end) {
+		h = rotate_left(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		h = rotate_left(h ^ ((unsigned char)*p * prime5), 11) * prime1;
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+// the parser options change the result, so they are part of the entry
+uint32_t parse_cache::options_of(token_parser& parser)
+{
+	return (parser.compact ? 1 : 0) | (parser.comments ? 2 : 0);
+}
+
+string parse_cache::entry_name(uint64_t key, token_parser& parser)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx-%u.tpc", (unsigned long long)key, options_of(parser));
+	return (filesystem::path(directory) / name).string();
+}
+
+template<typename T>
+static void put_value(output_buffer& buffer, T value)
+{
+	buffer.write((const char*)&value, sizeof(value));
+}
+
+// write n and its subtree in document order; in a compact tree a subtree
+// met a second time is written as a reference to its first record
+void parse_cache::write_node(output_buffer& buffer, node* n, uint32_t parent, uint32_t& count, unordered_map<node*, uint32_t>* first_record)
+{
+	uint32_t record = count++;
+	if (first_record != nullptr)
+		(*first_record)[n] = record;
+
+	put_value<uint8_t>(buffer, r_node);
+	put_value<uint32_t>(buffer, parent);
+	put_value<int32_t>(buffer, n->id);
+	put_value<uint8_t>(buffer, (uint8_t)n->data_type);
+	put_value<uint64_t>(buffer, n->source_begin);
+	put_value<uint64_t>(buffer, n->source_end);
+	put_value<uint64_t>(buffer, n->hash);
+	put_value<uint32_t>(buffer, (uint32_t)n->name.size());
+	put_value<uint32_t>(buffer, (uint32_t)n->data.size());
+	buffer.write(n->name);
+	buffer.write(n->data);
+
+	for (auto& child : n->children) {
+		if (child->parent == n)
+			write_node(buffer, child.get(), record, count, first_record);
+		else {
+			put_value<uint8_t>(buffer, r_shared);
+			put_value<uint32_t>(buffer, record);
+			put_value<uint32_t>(buffer, (*first_record)[child.get()]);
+			++count;
+		}
+	}
+}
+
+bool parse_cache::store(uint64_t key, size_t source_size, token_parser& parser)
+{
+	// a projected tree is not the result for the source
+	shared_ptr<node> root = parser.get_root();
+	if (root == nullptr || !parser.projection.empty())
+		return false;
+
+	error_code error;
+	filesystem::create_directories(directory, error);
+
+	// a name of its own, so processes storing the same entry do not meet
+	string file_name = entry_name(key, parser);
+	string temp_name = file_name + "." + std::to_string(random_device()()) + ".tmp";
+	{
+		ofstream out(temp_name, ios_base::out | ios_base::binary);
+		if (out.fail())
+			return false;
+
+		output_buffer buffer(out);
+		cache_header header;
+		memcpy(header.magic, cache_magic, sizeof(cache_magic));
+		header.key = key;
+		header.source_size = source_size;
+		header.options = options_of(parser);
+		header.reserved = 0;
+		buffer.write((const char*)&header, sizeof(header));
+
+		uint32_t count = 0;
+		unordered_map<node*, uint32_t> first_record;
+		write_node(buffer, root.get(), no_parent, count, parser.compact ? &first_record : nullptr);
+		put_value<uint8_t>(buffer, r_end);
+		put_value<uint32_t>(buffer, count);
+		buffer.flush();
+
+		if (out.fail()) {
+			out.close();
+			filesystem::remove(temp_name, error);
+			return false;
+		}
+	}
+
+	// rename replaces the entry in one step, readers see the old or the new file
+	filesystem::rename(temp_name, file_name, error);
+	if (error) {
+		filesystem::remove(temp_name, error);
+		return false;
+	}
+	evict();
+	return true;
+}
+
+// reads the values of a record, false when the entry ends too early
+struct record_reader
+{
+	const char* p;
+	const char* end;
+
+	template<typename T>
+	bool take(T& value) {
+		if ((size_t)(end - p) < sizeof(T))
+			return false;
+		memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+		return true;
+	}
+	bool take(string& s, uint32_t size) {
+		if ((size_t)(end - p) < size)
+			return false;
+		s.assign(p, size);
+		p += size;
+		return true;
+	}
+};
+
+bool parse_cache::load(uint64_t key, size_t source_size, token_parser& parser)
+{
+	if (!parser.node_list.empty() || !parser.projection.empty())
+		return false;
+
+	string file_name = entry_name(key, parser);
+	ifstream in(file_name, ios_base::in | ios_base::binary | ios_base::ate);
+	if (in.fail())
+		return false;
+	streamoff file_size = in.tellg();
+	if (file_size < (streamoff)sizeof(cache_header))
+		return false;
+	vector<char> entry((size_t)file_size);
+	in.seekg(0);
+	if (!in.read(entry.data(), file_size))
+		return false;
+
+	cache_header header;
+	memcpy(&header, entry.data(), sizeof(header));
+	if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.key != key
+		|| header.source_size != source_size || header.options != options_of(parser))
+		return false;
+
+	record_reader reader{ entry.data() + sizeof(header), entry.data() + entry.size() };
+	vector<shared_ptr<node> > records;
+	list<shared_ptr<node> > nodes;
+	while (true) {
+		uint8_t kind;
+		uint32_t parent;
+		if (!reader.take(kind))
+			return false;
+		if (kind == r_end) {
+			uint32_t count;
+			if (!reader.take(count) || count != records.size() || reader.p != reader.end || records.empty())
+				return false;
+			break;
+		}
+
+		// only the first record is the root, the others follow their parent
+		if (!reader.take(parent) || (parent == no_parent) != records.empty()
+			|| (parent != no_parent && parent >= records.size()))
+			return false;
+
+		if (kind == r_shared) {
+			uint32_t target;
+			if (!reader.take(target) || target >= records.size())
+				return false;
+			records[parent]->add_child(records[target]);
+			records.push_back(records[target]);
+			continue;
+		}
+		if (kind != r_node)
+			return false;
+
+		int32_t id;
+		uint8_t data_type;
+		uint64_t begin, end, hash;
+		uint32_t name_size, data_size;
+		string name, data;
+		if (!reader.take(id) || !reader.take(data_type) || !reader.take(begin) || !reader.take(end)
+			|| !reader.take(hash) || !reader.take(name_size) || !reader.take(data_size)
+			|| !reader.take(name, name_size) || !reader.take(data, data_size) || data_type > base_token::t_eof)
+			return false;
+
+		shared_ptr<node> n = make_shared<node>(id);
+		n->set_name(move(name));
+		n->set_data(move(data), (base_token::type_of_token)data_type);
+		n->set_source_begin((size_t)begin);
+		n->set_source_end((size_t)end);
+		n->hash = hash;
+		if (parent != no_parent) {
+			n->add_parent(records[parent].get());
+			records[parent]->add_child(n);
+		}
+		records.push_back(n);
+		nodes.push_back(n);
+	}
+
+	parser.node_list = move(nodes);
+
+	// a hit counts as a use for the eviction
+	error_code error;
+	filesystem::last_write_time(file_name, filesystem::file_time_type::clock::now(), error);
+	return true;
+}
+
+void parse_cache::evict()
+{
+	struct cache_entry
+	{
+		filesystem::file_time_type time;
+		uint64_t size;
+		filesystem::path path;
+	};
+	vector<cache_entry> entries;
+	uint64_t total = 0;
+	filesystem::file_time_type now = filesystem::file_time_type::clock::now();
+
+	// other processes may remove entries meanwhile, so errors only skip a file
+	error_code error;
+	for (filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+		const filesystem::path& path = it->path();
+		bool temporary = path.extension() == ".tmp";
+		if (path.extension() != ".tpc" && !temporary)
+			continue;
+
+		error_code file_error;
+		filesystem::file_time_type time = filesystem::last_write_time(path, file_error);
+		uint64_t size = filesystem::file_size(path, file_error);
+		if (file_error)
+			continue;
+
+		if (chrono::duration_cast<chrono::seconds>(now - time).count() > max_age)
+			filesystem::remove(path, file_error);
+		else if (!temporary) {
+			// a young temporary file is still being written
+			entries.push_back(cache_entry{ time, size, path });
+			total += size;
+		}
+	}
+
+	sort(entries.begin(), entries.end(),
+		[](const cache_entry& a, const cache_entry& b) { return a.time < b.time; });
+	for (auto& e : entries) {
+		if (total <= max_size)
+			break;
+		error_code file_error;
+		filesystem::remove(e.path, file_error);
+		total -= e.size;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef __CACHE_DEFINED__
+#define __CACHE_DEFINED__
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+class output_buffer;
+
+// On-disk cache of parse results, keyed by a hash of the source content.
+// Every entry is a file "<hash>-<options>.tpc" in the cache directory
+// holding the nodes of the tree in document order, so a hit needs one
+// read and no tokenize() or parse(). The files are in host byte order and
+// meant for the machine that wrote them.
+//
+// Several processes may share a directory: entries are written to a
+// temporary file and renamed into place, so a reader sees a whole entry
+// or none, and an entry that does not check out is treated as a miss.
+// After each store, entries older than max_age seconds are removed, then
+// the least recently used ones until the directory fits in max_size.
+
+class parse_cache
+{
+private:
+	string directory;
+	uint64_t max_size;
+	long long max_age;
+
+	static uint32_t options_of(token_parser& parser);
+	string entry_name(uint64_t key, token_parser& parser);
+	static void write_node(output_buffer& buffer, node* n, uint32_t parent, uint32_t& count, unordered_map<node*, uint32_t>* first_record);
+public:
+	parse_cache(const string& dir, uint64_t size = 256ULL << 20, long long age = 7 * 24 * 3600)
+		: directory(dir), max_size(size), max_age(age) { };
+
+	static uint64_t content_hash(const char* data, size_t size);
+
+	// fill the empty parser with the cached result, false on a miss
+	bool load(uint64_t key, size_t source_size, token_parser& parser);
+	// save the result of parser.parse(), false if it could not be written
+	bool store(uint64_t key, size_t source_size, token_parser& parser);
+	void evict();
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+#include "Diff.h"
+
+string node_change::to_string()
+{
+	// format: + path, - path or ~ path: old data -> new data
+	switch (type) {
+	case c_added:
+		return "+ " + path;
+	case c_removed:
+		return "- " + path;
+	default:
+		return "~ " + path + ": " + string(old_node->get_data()) + " -> " + string(new_node->get_data());
+	}
+}
+
+tree_diff::tree_diff(shared_ptr<node> old_root, shared_ptr<node> new_root)
+{
+	if (old_root == nullptr && new_root == nullptr)
+		return;
+	if (old_root == nullptr) {
+		changes.push_back(node_change(node_change::c_added, string(new_root->get_name()), nullptr, new_root));
+		return;
+	}
+	if (new_root == nullptr) {
+		changes.push_back(node_change(node_change::c_removed, string(old_root->get_name()), old_root, nullptr));
+		return;
+	}
+	if (old_root->get_name() != new_root->get_name()) {
+		changes.push_back(node_change(node_change::c_removed, string(old_root->get_name()), old_root, nullptr));
+		changes.push_back(node_change(node_change::c_added, string(new_root->get_name()), nullptr, new_root));
+		return;
+	}
+	diff_nodes(old_root, new_root, string(old_root->get_name()));
+}
+
+// the siblings of one name, in document order
+typedef unordered_map<string_view, vector<shared_ptr<node> > > sibling_groups;
+
+static void group_children(const list<shared_ptr<node> >& children, sibling_groups& groups)
+{
+	for (auto& child : children)
+		groups[child->get_name()].push_back(child);
+}
+
+static const size_t no_partner = (size_t)-1;
+
+// partner[k] is the old sibling paired with the k-th new one, or no_partner.
+// Siblings with equal subtrees pair up first, whatever their position, so
+// an inserted or removed sibling does not shift the pairs after it. The
+// rest pair up by position within the gaps between those pairs: a new
+// sibling between the pairs (a, b) only takes an old one between a and b.
+static vector<size_t> pair_siblings(const vector<shared_ptr<node> >& olds, const vector<shared_ptr<node> >& news, vector<bool>& taken)
+{
+	vector<size_t> partner(news.size(), no_partner);
+	vector<bool> equal(news.size(), false);
+	taken.assign(olds.size(), false);
+
+	// of old siblings with equal hashes the first one after the last pair
+	// is taken, so runs of equal siblings stay paired in order
+	unordered_map<uint64_t, pair<vector<size_t>, size_t> > by_hash;	// indexes, first not taken
+	for (size_t i = 0; i < olds.size(); ++i)
+		by_hash[olds[i]->get_hash()].first.push_back(i);
+	size_t next = 0;
+	for (size_t k = 0; k < news.size(); ++k) {
+		auto found = by_hash.find(news[k]->get_hash());
+		if (found == by_hash.end())
+			continue;
+		vector<size_t>& indexes = found->second.first;
+		size_t& first = found->second.second;
+		while (first < indexes.size() && taken[indexes[first]])
+			++first;
+		if (first == indexes.size())
+			continue;
+		auto it = lower_bound(indexes.begin() + first, indexes.end(), next);
+		while (it != indexes.end() && taken[*it])
+			++it;
+		if (it == indexes.end())
+			it = indexes.begin() + first;	// moved before the last pair
+
+		partner[k] = *it;
+		taken[*it] = true;
+		equal[k] = true;
+		next = *it + 1;
+	}
+
+	// the old end of the gap each new sibling is in
+	vector<size_t> gap_end(news.size());
+	size_t end = olds.size();
+	for (size_t k = news.size(); k-- > 0; ) {
+		gap_end[k] = end;
+		if (equal[k])
+			end = partner[k];
+	}
+
+	size_t i = 0;
+	for (size_t k = 0; k < news.size(); ++k) {
+		if (equal[k]) {
+			i = max(i, partner[k] + 1);
+			continue;
+		}
+		while (i < gap_end[k] && taken[i])
+			++i;
+		if (i < gap_end[k]) {
+			partner[k] = i;
+			taken[i++] = true;
+		}
+	}
+	return partner;
+}
+
+static string child_path(const string& path, string_view name, size_t index, size_t count)
+{
+	string p = path + "." + string(name);
+	if (count > 1)
+		p += "[" + std::to_string(index) + "]";
+	return p;
+}
+
+void tree_diff::diff_nodes(shared_ptr<node> old_node, shared_ptr<node> new_node, const string& path)
+{
+	// identical subtrees need no further look
+	if (old_node->get_hash() == new_node->get_hash())
+		return;
+
+	if (old_node->get_data() != new_node->get_data())
+		changes.push_back(node_change(node_change::c_changed, path, old_node, new_node));
+
+	const list<shared_ptr<node> >& old_children = old_node->get_children();
+	const list<shared_ptr<node> >& new_children = new_node->get_children();
+	sibling_groups old_groups, new_groups;
+	group_children(old_children, old_groups);
+	group_children(new_children, new_groups);
+
+	unordered_map<string_view, vector<size_t> > partners;
+	unordered_map<string_view, vector<bool> > taken;
+	for (auto& group : new_groups)
+		partners[group.first] = pair_siblings(old_groups[group.first], group.second, taken[group.first]);
+
+	unordered_map<string_view, size_t> seen;
+	for (auto& child : new_children)
+	{
+		string_view name = child->get_name();
+		size_t index = seen[name]++;
+		vector<shared_ptr<node> >& olds = old_groups[name];
+		size_t partner = partners[name][index];
+		if (partner != no_partner && olds[partner]->get_hash() == child->get_hash())
+			continue;
+
+		size_t count = max(olds.size(), new_groups[name].size());
+		string p = child_path(path, name, index, count);
+		if (partner != no_partner)
+			diff_nodes(olds[partner], child, p);
+		else
+			changes.push_back(node_change(node_change::c_added, p, nullptr, child));
+	}
+
+	// old siblings without a partner are gone
+	seen.clear();
+	for (auto& child : old_children)
+	{
+		string_view name = child->get_name();
+		size_t index = seen[name]++;
+		auto found = taken.find(name);
+		if (found != taken.end() && found->second[index])
+			continue;
+		size_t count = max(old_groups[name].size(), new_groups[name].size());
+		changes.push_back(node_change(node_change::c_removed, child_path(path, name, index, count), child, nullptr));
+	}
+}
+
+void tree_diff::print_changes()
+{
+	for (auto& c : changes)
+		cout << c.to_string() << endl;
+}
@@ -0,0 +1,52 @@
+#ifndef __DIFF_DEFINED__
+#define __DIFF_DEFINED__
+
+#pragma once
+
+#include <string>
+#include <list>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+// A single difference between two parsed documents. The path names the
+// node in the document it exists in, e.g. "shape.vertices.point[2].x";
+// the index is given for names occurring more than once among siblings.
+
+class node_change
+{
+public:
+	typedef enum {
+		c_added, c_removed, c_changed
+	} type_of_change;
+
+	type_of_change type;
+	string path;
+	shared_ptr<node> old_node;		// nullptr for c_added
+	shared_ptr<node> new_node;		// nullptr for c_removed
+
+	node_change(type_of_change t, const string& p, shared_ptr<node> o, shared_ptr<node> n)
+		: type(t), path(p), old_node(o), new_node(n) { };
+	string to_string();
+};
+
+// Structural diff of two trees built by token_parser::parse(). Subtrees
+// with equal content hashes are skipped without looking into them, so the
+// work depends on the size of the change, not on the size of the trees.
+// Siblings are paired by name: those with equal subtrees first, the rest
+// by their position among the remaining siblings of the same name.
+
+class tree_diff
+{
+private:
+	list<node_change> changes;
+	void diff_nodes(shared_ptr<node> old_node, shared_ptr<node> new_node, const string& path);
+public:
+	tree_diff(shared_ptr<node> old_root, shared_ptr<node> new_root);
+	const list<node_change>& get_changes() { return changes; }
+	bool empty() { return changes.empty(); }
+	void print_changes();
+};
+
+#endif
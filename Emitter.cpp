@@ -0,0 +1,341 @@
+#include <ostream>
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EMITTER_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+#include "Emitter.h"
+
+output_buffer::output_buffer(ostream& out, size_t size) : stream(out), capacity(size)
+{
+	buffer.reserve(capacity + 64);
+}
+
+void output_buffer::write(int value)
+{
+	char digits[16];
+	char* p = digits + sizeof(digits);
+	unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+	do {
+		*--p = (char)('0' + v % 10);
+		v /= 10;
+	} while (v != 0);
+	if (value < 0)
+		*--p = '-';
+	write(p, digits + sizeof(digits) - p);
+}
+
+void output_buffer::flush()
+{
+	stream.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+#ifdef EMITTER_SSE2
+// index of the lowest set bit, mask must not be 0
+static unsigned first_bit(int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, (unsigned long)mask);
+	return index;
+#else
+	return __builtin_ctz((unsigned)mask);
+#endif
+}
+#endif
+
+// length of the leading part of s[0..n) that contains neither a nor b nor
+// a control character; 16 bytes are checked at once where SSE2 is available
+static size_t plain_length(const char* s, size_t n, char a, char b)
+{
+	size_t i = 0;
+#ifdef EMITTER_SSE2
+	const __m128i va = _mm_set1_epi8(a);
+	const __m128i vb = _mm_set1_epi8(b);
+	const __m128i control = _mm_set1_epi8(0x1F);
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+			_mm_cmpeq_epi8(_mm_max_epu8(v, control), control));	// v <= 0x1F
+		int mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return i + first_bit(mask);
+	}
+#endif
+	for (; i < n; ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (c == (unsigned char)a || c == (unsigned char)b || c <= 0x1F)
+			break;
+	}
+	return i;
+}
+
+void node_emitter::write_json_string(const string& s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char* p = s.data();
+	size_t n = s.size();
+
+	out.put('\"');
+	while (n > 0) {
+		size_t plain = plain_length(p, n, '\"', '\\');
+		out.write(p, plain);
+		if (plain == n)
+			break;
+
+		unsigned char c = (unsigned char)p[plain];
+		switch (c) {
+		case '\"': out.write("\\\"", 2); break;
+		case '\\': out.write("\\\\", 2); break;
+		case '\n': out.write("\\n", 2); break;
+		case '\r': out.write("\\r", 2); break;
+		case '\t': out.write("\\t", 2); break;
+		default: {
+			char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F] };
+			out.write(u, 6);
+		}
+		}
+		p += plain + 1;
+		n -= plain + 1;
+	}
+	out.put('\"');
+}
+
+// node data keeps the escapes of the source, \" (\' in constant
+// literals) and \\, which are undone before the value is escaped for JSON
+static string source_unescape(const string& s, char quote)
+{
+	string plain;
+	plain.reserve(s.size());
+	for (size_t i = 0; i < s.size(); ++i) {
+		if (s[i] == '\\' && i + 1 < s.size() && (s[i + 1] == quote || s[i + 1] == '\\'))
+			++i;
+		plain += s[i];
+	}
+	return plain;
+}
+
+void node_emitter::write_json_data(node* n)
+{
+	// decimal integers are JSON numbers, hex ones stay strings
+	if (n->data_type == base_token::t_integer && !n->data.empty()
+		&& n->data.find_first_of("xX") == string::npos) {
+		out.write(n->data);
+		return;
+	}
+	if (n->data.find('\\') == string::npos)
+		write_json_string(n->data);
+	else
+		write_json_string(source_unescape(n->data, n->data_type == base_token::t_const_literal ? '\'' : '\"'));
+}
+
+// wide objects are grouped with a hash table, narrow ones by comparing names
+static const size_t narrow_object = 8;
+
+struct name_hash {
+	size_t operator()(const string* s) const { return hash<string>()(*s); }
+};
+struct name_equal {
+	bool operator()(const string* a, const string* b) const { return *a == *b; }
+};
+
+void node_emitter::write_json_value(node* n)
+{
+	if (n->children.empty()) {
+		write_json_data(n);
+		return;
+	}
+
+	// the members of the object, siblings of the same name in one group
+	vector<vector<node*> > groups;
+	if (n->children.size() <= narrow_object) {
+		for (auto& child : n->children) {
+			auto g = groups.begin();
+			while (g != groups.end() && (*g)[0]->name != child->name)
+				++g;
+			if (g == groups.end())
+				groups.push_back(vector<node*>(1, child.get()));
+			else
+				g->push_back(child.get());
+		}
+	}
+	else {
+		unordered_map<const string*, size_t, name_hash, name_equal> group_of;
+		for (auto& child : n->children) {
+			auto found = group_of.insert(make_pair(&child->name, groups.size()));
+			if (found.second)
+				groups.push_back(vector<node*>());
+			groups[found.first->second].push_back(child.get());
+		}
+	}
+
+	out.put('{');
+	for (size_t g = 0; g < groups.size(); ++g) {
+		if (g > 0)
+			out.put(',');
+		write_json_string(groups[g][0]->name);
+		out.put(':');
+		if (groups[g].size() == 1) {
+			write_json_value(groups[g][0]);
+			continue;
+		}
+		out.put('[');
+		for (size_t i = 0; i < groups[g].size(); ++i) {
+			if (i > 0)
+				out.put(',');
+			write_json_value(groups[g][i]);
+		}
+		out.put(']');
+	}
+	out.put('}');
+}
+
+// quote the field only when it contains a separator, quote or line break
+void node_emitter::write_csv_field(const string& s)
+{
+	if (plain_length(s.data(), s.size(), ',', '\"') == s.size()) {
+		out.write(s);
+		return;
+	}
+
+	out.put('\"');
+	for (char c : s) {
+		if (c == '\"')
+			out.put('\"');
+		out.put(c);
+	}
+	out.put('\"');
+}
+
+// tabs, line breaks and backslashes are written as C escape sequences
+void node_emitter::write_tsv_field(const string& s)
+{
+	const char* p = s.data();
+	size_t n = s.size();
+
+	while (n > 0) {
+		size_t plain = plain_length(p, n, '\\', '\t');
+		out.write(p, plain);
+		if (plain == n)
+			break;
+
+		switch (p[plain]) {
+		case '\\': out.write("\\\\", 2); break;
+		case '\t': out.write("\\t", 2); break;
+		case '\n': out.write("\\n", 2); break;
+		case '\r': out.write("\\r", 2); break;
+		default: out.put(p[plain]); break;
+		}
+		p += plain + 1;
+		n -= plain + 1;
+	}
+}
+
+void node_emitter::write_tuple(int id, int parent_id, node* n)
+{
+	// format (node_id, parent_id, name, data) => (1, 0, shape, )
+	out.put('(');
+	out.write(id);
+	out.write(", ", 2);
+	out.write(parent_id);
+	out.write(", ", 2);
+	out.write(n->name);
+	out.write(", ", 2);
+	out.write(n->data);
+	out.write(")\n", 2);
+}
+
+// visit n and its subtree in document order, id counts the nodes visited
+template<typename Row>
+void node_emitter::walk(node* n, int parent_id, int& id, Row row)
+{
+	int own_id = ++id;
+	row(own_id, parent_id, n);
+	for (auto& child : n->children)
+		walk(child.get(), own_id, id, row);
+}
+
+void node_emitter::emit_tuples(const list<shared_ptr<node> >& nodes)
+{
+	for (auto& n : nodes)
+		write_tuple(n->id, n->parent != nullptr ? n->parent->id : 0, n.get());
+	out.flush();
+}
+
+void node_emitter::emit_tuples(shared_ptr<node> root)
+{
+	int id = 0;
+	if (root != nullptr)
+		walk(root.get(), 0, id, [this](int i, int p, node* n) { write_tuple(i, p, n); });
+	out.flush();
+}
+
+void node_emitter::emit_json(shared_ptr<node> root)
+{
+	if (root != nullptr) {
+		out.put('{');
+		write_json_string(root->name);
+		out.put(':');
+		write_json_value(root.get());
+		out.put('}');
+	}
+	out.put('\n');
+	out.flush();
+}
+
+void node_emitter::write_row(int id, int parent_id, node* n, char separator)
+{
+	out.write(id);
+	out.put(separator);
+	out.write(parent_id);
+	out.put(separator);
+	if (separator == '\t') {
+		write_tsv_field(n->name);
+		out.put(separator);
+		write_tsv_field(n->data);
+	}
+	else {
+		write_csv_field(n->name);
+		out.put(separator);
+		write_csv_field(n->data);
+	}
+	out.put('\n');
+}
+
+static const char* table_columns[] = { "id", "parent", "name", "data" };
+
+void node_emitter::emit_table(const list<shared_ptr<node> >& nodes, char separator)
+{
+	for (int c = 0; c < 4; ++c) {
+		out.write(table_columns[c], strlen(table_columns[c]));
+		out.put(c < 3 ? separator : '\n');
+	}
+	for (auto& n : nodes)
+		write_row(n->id, n->parent != nullptr ? n->parent->id : 0, n.get(), separator);
+	out.flush();
+}
+
+void node_emitter::emit_table(shared_ptr<node> root, char separator)
+{
+	for (int c = 0; c < 4; ++c) {
+		out.write(table_columns[c], strlen(table_columns[c]));
+		out.put(c < 3 ? separator : '\n');
+	}
+	int id = 0;
+	if (root != nullptr)
+		walk(root.get(), 0, id, [this, separator](int i, int p, node* n) { write_row(i, p, n, separator); });
+	out.flush();
+}
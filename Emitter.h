@@ -0,0 +1,67 @@
+#ifndef __EMITTER_DEFINED__
+#define __EMITTER_DEFINED__
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <list>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+// Collects output in a large block and hands it to the stream in one
+// write, instead of going through the stream for every small piece.
+
+class output_buffer
+{
+private:
+	ostream& stream;
+	string buffer;
+	size_t capacity;
+public:
+	output_buffer(ostream& out, size_t size = 1 << 20);
+	~output_buffer() { flush(); }
+
+	void put(char c) { buffer += c; if (buffer.size() >= capacity) flush(); }
+	void write(const char* s, size_t n) { buffer.append(s, n); if (buffer.size() >= capacity) flush(); }
+	void write(const string& s) { write(s.data(), s.size()); }
+	void write(int value);
+	void flush();
+};
+
+// Writes the parsed nodes in one of the output formats:
+// - tuple: (id, parent, name, data) lines as printed by node::to_string()
+// - json:  nested objects following the braces of the source, siblings
+//          sharing a name are collected in an array; values are the
+//          text of the literals, decimal integers are written as numbers
+// - csv/tsv: one row per node with the columns id, parent, name, data
+
+class node_emitter
+{
+private:
+	output_buffer out;
+
+	void write_json_string(const string& s);
+	void write_json_data(node* n);
+	void write_json_value(node* n);
+	void write_csv_field(const string& s);
+	void write_tsv_field(const string& s);
+	void write_tuple(int id, int parent_id, node* n);
+	void write_row(int id, int parent_id, node* n, char separator);
+	template<typename Row> void walk(node* n, int parent_id, int& id, Row row);
+public:
+	node_emitter(ostream& stream) : out(stream) { };
+
+	void emit_tuples(const list<shared_ptr<node> >& nodes);
+	void emit_json(shared_ptr<node> root);
+	void emit_table(const list<shared_ptr<node> >& nodes, char separator);
+
+	// the same from the tree itself, numbering the nodes in document order;
+	// this is needed for trees with shared subtrees (compact mode)
+	void emit_tuples(shared_ptr<node> root);
+	void emit_table(shared_ptr<node> root, char separator);
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace std;
+
+#include "Index.h"
+#include "Emitter.h"
+#include "Cache.h"
+
+static const char index_header[] = "# token_parser index ";
+
+struct index_entry
+{
+	string path;
+	size_t begin;
+	size_t end;
+
+	bool operator<(const index_entry& other) const { return path < other.path; }
+};
+
+static void collect_entries(node* n, const string& path, int depth, vector<index_entry>& entries)
+{
+	entries.push_back(index_entry{ path, n->get_source_begin(), n->get_source_end() });
+	if (depth == 0)
+		return;
+
+	const list<shared_ptr<node> >& children = n->get_children();
+	unordered_map<string_view, size_t> count, seen;
+	for (auto& child : children)
+		++count[child->get_name()];
+
+	for (auto& child : children) {
+		string_view name = child->get_name();
+		string p = path + "." + string(name);
+		size_t index = seen[name]++;
+		if (count[name] > 1)
+			p += "[" + std::to_string(index) + "]";
+		collect_entries(child.get(), p, depth - 1, entries);
+	}
+}
+
+bool subtree_index::build(token_parser& parser, const char* source, size_t source_size, int depth, const string& index_file)
+{
+	shared_ptr<node> root = parser.get_root();
+	if (root == nullptr)
+		return false;
+
+	vector<index_entry> entries;
+	collect_entries(root.get(), string(root->get_name()), depth, entries);
+	sort(entries.begin(), entries.end());
+
+	ofstream out(index_file, ios_base::out | ios_base::binary);
+	if (out.fail())
+		return false;
+
+	output_buffer buffer(out);
+	char hash[20];
+	snprintf(hash, sizeof(hash), " %016llx\n", (unsigned long long)parse_cache::content_hash(source, source_size));
+	buffer.write(index_header + std::to_string(source_size) + hash);
+	for (auto& e : entries) {
+		buffer.write(e.path);
+		buffer.write("\t" + std::to_string(e.begin) + "\t" + std::to_string(e.end) + "\n");
+	}
+	buffer.flush();
+	return !out.fail();
+}
+
+bool subtree_loader::open(const string& source_file, const string& index_file)
+{
+	if (!source.open(source_file) || !index.open(index_file))
+		return false;
+
+	// the header names the size and the content hash of the source the
+	// index was built for; an edit keeping the size moves the ranges too
+	const char* data = index.data();
+	size_t header_size = sizeof(index_header) - 1;
+	if (index.size() <= header_size || memcmp(data, index_header, header_size) != 0)
+		return false;
+	const char* line_end = (const char*)memchr(data, '\n', index.size());
+	if (line_end == nullptr)
+		return false;
+	char* p;
+	if (strtoull(data + header_size, &p, 10) != source.size() || p >= line_end || *p != ' ')
+		return false;
+	if (strtoull(p + 1, nullptr, 16) != parse_cache::content_hash(source.data(), source.size()))
+		return false;
+
+	first_entry = line_end - data + 1;
+	return true;
+}
+
+// binary search over the sorted lines of the index, lo and hi are
+// always at the start of a line
+bool subtree_loader::find(const string& path, size_t& begin, size_t& end)
+{
+	const char* data = index.data();
+	size_t lo = first_entry;
+	size_t hi = index.size();
+
+	while (lo < hi) {
+		size_t line = lo + (hi - lo) / 2;
+		while (line > lo && data[line - 1] != '\n')
+			--line;
+
+		const char* line_end = (const char*)memchr(data + line, '\n', index.size() - line);
+		size_t next_line = line_end != nullptr ? line_end - data + 1 : index.size();
+		const char* tab = (const char*)memchr(data + line, '\t', next_line - line);
+		if (tab == nullptr)
+			return false;
+
+		size_t length = tab - (data + line);
+		int c = memcmp(path.data(), data + line, min(path.size(), length));
+		if (c == 0 && path.size() != length)
+			c = path.size() < length ? -1 : 1;
+
+		if (c == 0) {
+			char* p;
+			begin = (size_t)strtoull(tab + 1, &p, 10);
+			end = (size_t)strtoull(p, nullptr, 10);
+			return begin <= end && end <= source.size();
+		}
+		if (c < 0)
+			hi = line;
+		else
+			lo = next_line;
+	}
+	return false;
+}
+
+shared_ptr<token_parser> subtree_loader::load(const string& path)
+{
+	size_t begin, end;
+	if (!find(path, begin, end))
+		return nullptr;
+
+	shared_ptr<token_parser> parser = make_shared<token_parser>(source.data() + begin, end - begin);
+	if (!parser->tokenize() || !parser->parse())
+		return nullptr;
+	return parser;
+}
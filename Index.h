@@ -0,0 +1,49 @@
+#ifndef __INDEX_DEFINED__
+#define __INDEX_DEFINED__
+
+#pragma once
+
+#include <string>
+
+#include "Tokenizer.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+// Sidecar index of a source file: the byte range of every node down to a
+// given depth (the root has depth 0), by path such as
+// "shape.vertices.point[2]"; the index is given for names occurring more
+// than once among siblings. The index is a text file with a header line
+// naming the size and content hash of the source, and one
+// "path<TAB>begin<TAB>end" line per node, sorted by path.
+
+class subtree_index
+{
+public:
+	// parser holds the tree parsed from source
+	static bool build(token_parser& parser, const char* source, size_t source_size, int depth, const string& index_file);
+};
+
+// Loads single subtrees of a source with an index built for it. Both files
+// are mapped, the path is found by binary search in the index and only
+// the byte range of the subtree is tokenized and parsed.
+
+class subtree_loader
+{
+private:
+	mapped_file source;
+	mapped_file index;
+	size_t first_entry;				// offset of the first line after the header
+
+	bool find(const string& path, size_t& begin, size_t& end);
+public:
+	subtree_loader() : first_entry(0) { };
+	// false if a file cannot be opened or the index is not for this source,
+	// which is checked by its size and content hash
+	bool open(const string& source_file, const string& index_file);
+	// the parsed subtree, nullptr if the path is not in the index or its
+	// range does not parse
+	shared_ptr<token_parser> load(const string& path);
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+
+mapped_file::mapped_file()
+	: view(nullptr), view_size(0), opened(false), file_handle(INVALID_HANDLE_VALUE), mapping_handle(nullptr)
+{
+}
+
+bool mapped_file::open(const string& file_name)
+{
+	close();
+	file_handle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size)) {
+		close();
+		return false;
+	}
+	view_size = (size_t)file_size.QuadPart;
+	opened = true;
+	if (view_size == 0)
+		return true;	// nothing to map
+
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle != nullptr)
+		view = (const char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (view != nullptr)
+		UnmapViewOfFile(view);
+	if (mapping_handle != nullptr)
+		CloseHandle(mapping_handle);
+	if (file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+	view = nullptr;
+	view_size = 0;
+	opened = false;
+	mapping_handle = nullptr;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+mapped_file::mapped_file()
+	: view(nullptr), view_size(0), opened(false), file_descriptor(-1)
+{
+}
+
+bool mapped_file::open(const string& file_name)
+{
+	close();
+	file_descriptor = ::open(file_name.c_str(), O_RDONLY);
+	if (file_descriptor < 0)
+		return false;
+
+	struct stat file_status;
+	if (fstat(file_descriptor, &file_status) != 0) {
+		close();
+		return false;
+	}
+	view_size = (size_t)file_status.st_size;
+	opened = true;
+	if (view_size == 0)
+		return true;	// nothing to map
+
+	void* p = mmap(nullptr, view_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	if (p == MAP_FAILED) {
+		close();
+		return false;
+	}
+	view = (const char*)p;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (view != nullptr)
+		munmap((void*)view, view_size);
+	if (file_descriptor >= 0)
+		::close(file_descriptor);
+	view = nullptr;
+	view_size = 0;
+	opened = false;
+	file_descriptor = -1;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __MAPPED_FILE_DEFINED__
+#define __MAPPED_FILE_DEFINED__
+
+#pragma once
+
+#include <string>
+
+using namespace std;
+
+// A file mapped read-only into memory, so parts of it can be read
+// without going through a stream.
+
+class mapped_file
+{
+private:
+	const char* view;				// nullptr for an empty file
+	size_t view_size;
+	bool opened;
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int file_descriptor;
+#endif
+public:
+	mapped_file();
+	~mapped_file() { close(); }
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	bool open(const string& file_name);
+	void close();
+	bool is_open() { return opened; }
+	const char* data() { return view; }
+	size_t size() { return view_size; }
+};
+
+#endif
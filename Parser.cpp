@@ -4,8 +4,143 @@
 #include <iostream>
 #include <fstream>
 #include <list>
+#include <vector>
+#include <chrono>
 
 #include "Tokenizer.h"
+#include "Diff.h"
+#include "Index.h"
+#include "Cache.h"
+#include "Watch.h"
+
+// print the structural differences between two documents
+static int diff_files(string old_filename, string new_filename)
+{
+	fstream old_source(old_filename.c_str(), ios_base::in);
+	fstream new_source(new_filename.c_str(), ios_base::in);
+	if (old_source.fail() || new_source.fail()) {
+		cout << "Error occurred during opening " << (old_source.fail() ? old_filename : new_filename) << endl;
+		return 0;
+	}
+
+	token_parser old_parser(old_source);
+	if (!old_parser.tokenize() || !old_parser.parse())
+		_exit(-1);
+
+	token_parser new_parser(new_source);
+	if (!new_parser.tokenize() || !new_parser.parse())
+		_exit(-1);
+
+	tree_diff diff(old_parser.get_root(), new_parser.get_root());
+	diff.print_changes();
+	return diff.empty() ? 0 : 1;
+}
+
+// write the sidecar index input_file.idx
+static int index_file(string input_filename, int depth)
+{
+	// the index holds the content hash of the source, so it is read whole
+	mapped_file source;
+	if (!source.open(input_filename)) {
+		cout << "Error occurred during opening " << input_filename << endl;
+		return 0;
+	}
+
+	token_parser parser(source.data(), source.size());
+	if (!parser.tokenize())
+		return 0;
+	if (!parser.parse())
+		_exit(-1);
+
+	if (!subtree_index::build(parser, source.data(), source.size(), depth, input_filename + ".idx"))
+		cout << "Error occurred during writing " << input_filename << ".idx" << endl;
+	return 0;
+}
+
+// parse only the subtree at path, using input_file.idx
+static int load_subtree(string input_filename, string path, string output_filename)
+{
+	subtree_loader loader;
+	if (!loader.open(input_filename, input_filename + ".idx")) {
+		cout << "No valid index " << input_filename << ".idx, run parser --index first" << endl;
+		return 0;
+	}
+
+	shared_ptr<token_parser> parser = loader.load(path);
+	if (parser == nullptr) {
+		cout << path << " is not in the index" << endl;
+		return 0;
+	}
+	parser->print_file(output_filename);
+	return 0;
+}
+
+// parse input_file through the cache in cache_directory: a source parsed
+// before is not tokenized again
+static int parse_cached(string input_filename, string output_filename, token_parser::output_format format,
+	bool compact, bool comments, string cache_directory)
+{
+	mapped_file source;
+	if (!source.open(input_filename)) {
+		cout << "Error occurred during opening " << input_filename << endl;
+		_exit(0);
+	}
+
+	cout << "Start parsing " << input_filename << endl;
+
+	token_parser parser(source.data(), source.size());
+	parser.set_compact(compact);
+	parser.set_comments(comments);
+
+	parse_cache cache(cache_directory);
+	uint64_t key = parse_cache::content_hash(source.data(), source.size());
+	if (!cache.load(key, source.size(), parser)) {
+		if (!parser.tokenize())
+			_exit(0);
+		if (!parser.parse())
+			_exit(-1);
+		cache.store(key, source.size(), parser);
+	}
+
+	parser.print_file(output_filename, format);
+
+	cout << "Parsing finished." << endl;
+
+	return 0;
+}
+
+// parse the files, then parse them again whenever they change and print
+// what changed
+static int watch_files(const vector<string>& paths)
+{
+	file_watcher watcher;
+	for (auto& path : paths) {
+		if (!watcher.add(path)) {
+			cout << "Error occurred during opening " << path << endl;
+			return 0;
+		}
+	}
+
+	document_set documents;
+	list<node_change> changes;
+	for (auto& file : watcher.files())
+		documents.refresh(file, changes);
+	cout << "Watching " << documents.size() << " files" << endl;
+
+	vector<string> changed;
+	while (!(changed = watcher.wait()).empty()) {
+		for (auto& file : changed) {
+			auto start = chrono::steady_clock::now();
+			if (!documents.refresh(file, changes))
+				continue;
+			auto time = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+			cout << file << ": " << changes.size() << " changes, reloaded in " << time.count() / 1000.0 << " ms" << endl;
+			for (auto& c : changes)
+				cout << c.to_string() << endl;
+		}
+	}
+	return 0;
+}
 
 // main program entry point
 int main(int argc, char* argv[])
@@ -13,16 +148,88 @@ int main(int argc, char* argv[])
 	// Check to see that we have at least a input filename
 	if (argc < 2) {
 		cout << "Invalid command line arguments: need filename" << endl;
-		cout << "  parser input_file <output_file>" << endl << endl;
+		cout << "  parser input_file <output_file> <--format tuple|json|csv|tsv|source> <--compact> <--no-comments> <--cache directory> <--select path>" << endl;
+		cout << "  parser --diff old_file new_file" << endl;
+		cout << "  parser --index input_file <depth>" << endl;
+		cout << "  parser --subtree input_file path <output_file>" << endl;
+		cout << "  parser --watch file_or_directory..." << endl << endl;
 		cout << "If no output file is specified, output will be done to std output." << endl;
 		_exit(0);
 	}
 
-	string input_filename = argv[1];
-	string output_filename = string::basic_string();
+	if (string(argv[1]) == "--diff") {
+		if (argc < 4) {
+			cout << "Invalid command line arguments: --diff needs two filenames" << endl;
+			_exit(0);
+		}
+		return diff_files(argv[2], argv[3]);
+	}
+
+	if (string(argv[1]) == "--index") {
+		if (argc < 3) {
+			cout << "Invalid command line arguments: --index needs a filename" << endl;
+			_exit(0);
+		}
+		return index_file(argv[2], argc > 3 ? atoi(argv[3]) : 2);
+	}
+
+	if (string(argv[1]) == "--subtree") {
+		if (argc < 4) {
+			cout << "Invalid command line arguments: --subtree needs a filename and a path" << endl;
+			_exit(0);
+		}
+		return load_subtree(argv[2], argv[3], argc > 4 ? argv[4] : "");
+	}
+
+	if (string(argv[1]) == "--watch") {
+		if (argc < 3) {
+			cout << "Invalid command line arguments: --watch needs a file or directory" << endl;
+			_exit(0);
+		}
+		return watch_files(vector<string>(argv + 2, argv + argc));
+	}
 
-	if (argc > 2)
-		output_filename = argv[2];
+	string input_filename;
+	string output_filename;
+	token_parser::output_format format = token_parser::f_tuple;
+	bool compact = false;
+	bool comments = true;
+	string cache_directory;
+	vector<string> projection;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--format" && i + 1 < argc) {
+			string name = argv[++i];
+			if (name == "json")
+				format = token_parser::f_json;
+			else if (name == "csv")
+				format = token_parser::f_csv;
+			else if (name == "tsv")
+				format = token_parser::f_tsv;
+			else if (name == "source")
+				format = token_parser::f_source;
+			else if (name != "tuple") {
+				cout << "Unknown output format " << name << endl;
+				_exit(0);
+			}
+		}
+		else if (arg == "--compact")
+			compact = true;
+		else if (arg == "--no-comments")
+			comments = false;
+		else if (arg == "--cache" && i + 1 < argc)
+			cache_directory = argv[++i];
+		else if (arg == "--select" && i + 1 < argc)
+			projection.push_back(argv[++i]);
+		else if (input_filename.empty())
+			input_filename = arg;
+		else
+			output_filename = arg;
+	}
+
+	if (!cache_directory.empty() && projection.empty())
+		return parse_cached(input_filename, output_filename, format, compact, comments, cache_directory);
 
 	fstream source;
 
@@ -37,15 +244,20 @@ int main(int argc, char* argv[])
 	
 	// Create the token list
 	token_parser parser(source);
+	parser.set_compact(compact);
+	parser.set_comments(comments);
+	parser.set_projection(projection);
 
 	// tokenize - lexical analysis
-	parser.tokenize();
+	if (!parser.tokenize())
+		_exit(0);
 
 	// parse - syntax analysis
-	parser.parse();
+	if (!parser.parse())
+		_exit(-1);
 
 	// output
-	parser.print_file(output_filename);
+	parser.print_file(output_filename, format);
 
 	cout << "Parsing finished." << endl;
 
@@ -0,0 +1,154 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+#include "Query.h"
+
+// number of nodes a worker takes at once, small enough to keep all
+// workers busy until the end and large enough to make the hand-off cheap
+static const size_t chunk_size = 16384;
+
+node_query::node_query(token_parser& parser, unsigned threads)
+	: workers(threads)
+{
+	const list<shared_ptr<node> >& node_list = parser.get_nodes();
+	nodes.reserve(node_list.size());
+	for (auto& n : node_list)
+		nodes.push_back(n.get());
+
+	if (workers == 0)
+		workers = max(1u, thread::hardware_concurrency());
+	// no point in starting threads which would not get a single chunk
+	workers = (unsigned)min<size_t>(workers, nodes.size() / chunk_size + 1);
+}
+
+node_query& node_query::name(const string& n)
+{
+	name_filter = n;
+	return *this;
+}
+
+node_query& node_query::path(const string& pattern)
+{
+	path_filter.clear();
+	size_t start = 0;
+	while (true) {
+		size_t dot = pattern.find('.', start);
+		path_filter.push_back(pattern.substr(start, dot - start));
+		if (dot == string::npos)
+			break;
+		start = dot + 1;
+	}
+	return *this;
+}
+
+bool node_query::matches(node* n) const
+{
+	if (!name_filter.empty() && n->name != name_filter)
+		return false;
+	if (!path_filter.empty() && !match_path(n, (int)path_filter.size() - 1))
+		return false;
+	return true;
+}
+
+// match the pattern from its last segment backwards along the parent links,
+// so no path string has to be built for the node
+bool node_query::match_path(node* n, int segment) const
+{
+	if (segment < 0)
+		return n == nullptr;
+
+	const string& pattern = path_filter[segment];
+	if (pattern == "**") {
+		// either it matches no name at all or it takes this one
+		if (match_path(n, segment - 1))
+			return true;
+		return n != nullptr && match_path(n->parent, segment);
+	}
+
+	if (n == nullptr)
+		return false;
+	if (pattern != "*" && pattern != n->name)
+		return false;
+	return match_path(n->parent, segment - 1);
+}
+
+// run task over the whole node table, chunk by chunk
+void node_query::schedule(const function<void(size_t, size_t, unsigned)>& task) const
+{
+	if (workers <= 1) {
+		task(0, nodes.size(), 0);
+		return;
+	}
+
+	atomic<size_t> next_chunk(0);
+	auto worker_loop = [&](unsigned worker) {
+		while (true) {
+			size_t begin = next_chunk.fetch_add(chunk_size);
+			if (begin >= nodes.size())
+				return;
+			task(begin, min(begin + chunk_size, nodes.size()), worker);
+		}
+	};
+
+	vector<thread> pool;
+	for (unsigned w = 1; w < workers; ++w)
+		pool.emplace_back(worker_loop, w);
+	worker_loop(0);
+	for (auto& t : pool)
+		t.join();
+}
+
+size_t node_query::count() const
+{
+	return reduce<size_t>(0,
+		[](const node&) { return (size_t)1; },
+		[](size_t a, size_t b) { return a + b; });
+}
+
+vector<node*> node_query::select() const
+{
+	// every chunk keeps its own matches, so the result stays in document order
+	size_t chunks = (nodes.size() + chunk_size - 1) / chunk_size;
+	vector<vector<node*> > found(max<size_t>(chunks, 1));
+
+	schedule([&](size_t begin, size_t end, unsigned) {
+		vector<node*>& f = found[begin / chunk_size];
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (matches(nodes[i]))
+				f.push_back(nodes[i]);
+		}
+	});
+
+	vector<node*> result;
+	for (auto& f : found)
+		result.insert(result.end(), f.begin(), f.end());
+	return result;
+}
+
+map<string, size_t> node_query::count_by_name() const
+{
+	vector<worker_slot<unordered_map<string, size_t> > > partial(workers);
+
+	schedule([&](size_t begin, size_t end, unsigned worker) {
+		unordered_map<string, size_t>& counts = partial[worker].value;
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (matches(nodes[i]))
+				++counts[nodes[i]->name];
+		}
+	});
+
+	map<string, size_t> result;
+	for (auto& counts : partial)
+		for (auto& c : counts.value)
+			result[c.first] += c.second;
+	return result;
+}
@@ -0,0 +1,83 @@
+#ifndef __QUERY_DEFINED__
+#define __QUERY_DEFINED__
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+// A query over the nodes of a parsed tree. Nodes are selected by name
+// and/or by path pattern (e.g. "shape.vertices.point.x"), where "*"
+// matches any single name and "**" any number of names. Matching nodes
+// are projected and reduced in parallel: the flat node table is cut into
+// chunks which idle worker threads keep taking until none are left.
+
+class node_query
+{
+private:
+	vector<node*> nodes;			// all nodes in document order
+	string name_filter;
+	vector<string> path_filter;		// the path pattern split at '.'
+	unsigned workers;
+
+	// the result of one worker, alone on its cache line so that workers
+	// do not write to each other's lines
+	template<typename T>
+	struct alignas(64) worker_slot
+	{
+		T value;
+	};
+
+	bool matches(node* n) const;
+	bool match_path(node* n, int segment) const;
+	void schedule(const function<void(size_t, size_t, unsigned)>& task) const;
+public:
+	// threads == 0 uses all hardware threads
+	node_query(token_parser& parser, unsigned threads = 0);
+
+	node_query& name(const string& n);
+	node_query& path(const string& pattern);
+	unsigned get_workers() const { return workers; }
+
+	size_t count() const;
+	vector<node*> select() const;
+	map<string, size_t> count_by_name() const;
+
+	// combine(acc, project(node)) is folded over all matching nodes;
+	// identity must be neutral for combine, as every worker starts with it
+	template<typename T, typename Project, typename Combine>
+	T reduce(T identity, Project project, Combine combine) const;
+
+	// non-copying access for projections
+	static const string& name_of(const node& n) { return n.name; }
+	static const string& data_of(const node& n) { return n.data; }
+};
+
+template<typename T, typename Project, typename Combine>
+T node_query::reduce(T identity, Project project, Combine combine) const
+{
+	vector<worker_slot<T> > partial(workers, worker_slot<T>{ identity });
+
+	schedule([&](size_t begin, size_t end, unsigned worker) {
+		T acc = partial[worker].value;
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (matches(nodes[i]))
+				acc = combine(acc, project(*nodes[i]));
+		}
+		partial[worker].value = acc;
+	});
+
+	T result = identity;
+	for (auto& p : partial)
+		result = combine(result, p.value);
+	return result;
+}
+
+#endif
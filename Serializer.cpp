@@ -0,0 +1,156 @@
+#include <ostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+#include "Serializer.h"
+#include "Emitter.h"
+
+// collects the text of one subtree formatted by a worker thread
+struct string_sink
+{
+	string text;
+	void put(char c) { text += c; }
+	void write(const char* s, size_t n) { text.append(s, n); }
+	void write(const string& s) { text += s; }
+};
+
+tree_serializer::tree_serializer(bool pretty_print, unsigned threads)
+	: pretty(pretty_print), workers(threads)
+{
+	if (workers == 0)
+		workers = max(1u, thread::hardware_concurrency());
+}
+
+// a literal keeps its escape sequences, only the quotes and a trailing
+// backslash which would end the literal early are escaped
+template<typename Sink>
+static void write_quoted(Sink& out, const string& data, char quote)
+{
+	out.put(quote);
+	for (size_t i = 0; i < data.size(); ++i) {
+		char c = data[i];
+		if (c == '\\') {
+			out.put('\\');
+			if (i + 1 < data.size())
+				out.put(data[++i]);
+			else
+				out.put('\\');
+			continue;
+		}
+		if (c == quote)
+			out.put('\\');
+		out.put(c);
+	}
+	out.put(quote);
+}
+
+template<typename Sink>
+void tree_serializer::write_value(Sink& out, node* n)
+{
+	const string& data = n->data;
+
+	switch (n->data_type) {
+	case base_token::t_integer:
+		// the tokenizer wants a blank after a decimal 0; other numbers
+		// starting with 0 do not tokenize, so those are written quoted
+		if (data == "0") {
+			out.write("0 ", 2);
+			return;
+		}
+		if (data.empty() || (data[0] == '0' && data[1] != 'x' && data[1] != 'X'))
+			break;
+		out.write(data);
+		return;
+	case base_token::t_const_literal:
+		write_quoted(out, data, '\'');
+		return;
+	default:
+		break;
+	}
+	write_quoted(out, data, '\"');
+}
+
+template<typename Sink>
+void tree_serializer::write_node(Sink& out, node* n, int depth)
+{
+	if (pretty)
+		for (int i = 0; i < depth; ++i)
+			out.put('\t');
+
+	out.write(n->name);
+	out.write(pretty ? " = " : "=", pretty ? 3 : 1);
+
+	if (n->children.empty()) {
+		write_value(out, n);
+		if (pretty)
+			out.put('\n');
+		return;
+	}
+
+	out.put('{');
+	if (pretty)
+		out.put('\n');
+	bool first = true;
+	for (auto& child : n->children) {
+		if (!pretty && !first)
+			out.put(' ');
+		first = false;
+		write_node(out, child.get(), depth + 1);
+	}
+	if (pretty)
+		for (int i = 0; i < depth; ++i)
+			out.put('\t');
+	out.put('}');
+	if (pretty)
+		out.put('\n');
+}
+
+void tree_serializer::write(shared_ptr<node> root, ostream& stream)
+{
+	output_buffer out(stream);
+	if (root == nullptr)
+		return;
+
+	vector<node*> top;
+	for (auto& child : root->children)
+		top.push_back(child.get());
+
+	if (workers <= 1 || top.size() < 2) {
+		write_node(out, root.get(), 0);
+		if (!pretty)
+			out.put('\n');
+		return;
+	}
+
+	// the children of the root are formatted in parallel, each worker takes
+	// the next unformatted one until none are left
+	vector<string_sink> parts(top.size());
+	atomic<size_t> next_part(0);
+	auto worker_loop = [&]() {
+		size_t i;
+		while ((i = next_part.fetch_add(1)) < top.size())
+			write_node(parts[i], top[i], 1);
+	};
+
+	vector<thread> pool;
+	for (unsigned w = 1; w < min<size_t>(workers, top.size()); ++w)
+		pool.emplace_back(worker_loop);
+	worker_loop();
+	for (auto& t : pool)
+		t.join();
+
+	out.write(root->name);
+	out.write(pretty ? " = {\n" : "={", pretty ? 5 : 2);
+	for (size_t i = 0; i < parts.size(); ++i) {
+		if (!pretty && i > 0)
+			out.put(' ');
+		out.write(parts[i].text);
+		string().swap(parts[i].text);
+	}
+	out.write("}\n", 2);
+}
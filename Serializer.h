@@ -0,0 +1,35 @@
+#ifndef __SERIALIZER_DEFINED__
+#define __SERIALIZER_DEFINED__
+
+#pragma once
+
+#include <ostream>
+#include <string>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+// Writes a tree back in the input grammar, either compact on one line
+// (shape={type="tetrahedron" ...}) or pretty printed with one value per
+// line and tab indentation. Values read by the parser are written exactly
+// as they appeared in the source, values set by a program are quoted and
+// escaped where needed, so parsing the output gives the same tree again.
+// With more than one thread the children of the root are formatted in
+// parallel and written in order afterwards.
+
+class tree_serializer
+{
+private:
+	bool pretty;
+	unsigned workers;
+
+	template<typename Sink> void write_node(Sink& out, node* n, int depth);
+	template<typename Sink> void write_value(Sink& out, node* n);
+public:
+	// threads == 0 uses all hardware threads
+	tree_serializer(bool pretty_print = false, unsigned threads = 1);
+	void write(shared_ptr<node> root, ostream& stream);
+};
+
+#endif
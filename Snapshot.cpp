@@ -0,0 +1,179 @@
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+using namespace std;
+
+#include "Snapshot.h"
+
+// copy n and its subtree, the children of a node get their slots in the
+// child table before the first of them is copied
+size_t tree_snapshot::add_node(node* n, size_t parent)
+{
+	size_t index = nodes.size();
+	const list<shared_ptr<node> >& node_children = n->get_children();
+
+	frozen_node f;
+	f.id = (int)index + 1;
+	f.parent = parent;
+	f.first_child = children.size();
+	f.child_count = node_children.size();
+	f.name = n->get_name();
+	f.data = n->get_data();
+	f.hash = n->get_hash();
+	nodes.push_back(f);
+
+	children.resize(children.size() + node_children.size());
+	size_t k = 0;
+	for (auto& child : node_children) {
+		size_t child_index = add_node(child.get(), index);
+		children[nodes[index].first_child + k++] = child_index;
+	}
+	return index;
+}
+
+shared_ptr<const tree_snapshot> tree_snapshot::freeze(shared_ptr<node> root)
+{
+	shared_ptr<tree_snapshot> snapshot = make_shared<tree_snapshot>();
+	if (root != nullptr)
+		snapshot->add_node(root.get(), npos);
+	return snapshot;
+}
+
+size_t tree_snapshot::find(const string& path) const
+{
+	if (nodes.empty())
+		return npos;
+
+	size_t start = 0;
+	size_t i = npos;
+	while (true) {
+		size_t dot = path.find('.', start);
+		string name = path.substr(start, dot - start);
+
+		size_t found = npos;
+		if (i == npos) {
+			if (nodes[0].name == name)
+				found = 0;
+		}
+		else {
+			for (size_t k = 0; k < nodes[i].child_count; ++k) {
+				if (nodes[child(i, k)].name == name) {
+					found = child(i, k);
+					break;
+				}
+			}
+		}
+		if (found == npos || dot == string::npos)
+			return found;
+		i = found;
+		start = dot + 1;
+	}
+}
+
+const char hazard_slots::claimed = 0;
+
+hazard_slots::hazard_slots()
+{
+	for (auto& s : slots)
+		s.pointer = nullptr;
+}
+
+// take a free slot, starting at one of this thread's own
+size_t hazard_slots::take() const
+{
+	size_t i = hash<thread::id>()(this_thread::get_id()) % slot_count;
+	while (true) {
+		const void* expected = nullptr;
+		if (slots[i].pointer.compare_exchange_weak(expected, &claimed))
+			return i;
+		i = (i + 1) % slot_count;
+	}
+}
+
+bool hazard_slots::in_use(const void* pointer) const
+{
+	for (auto& s : slots) {
+		if (s.pointer.load() == pointer)
+			return true;
+	}
+	return false;
+}
+
+snapshot_holder::snapshot_holder() : current(nullptr)
+{
+}
+
+snapshot_holder::~snapshot_holder()
+{
+	delete current.load();
+	for (auto record : retired_records)
+		delete record;
+}
+
+shared_ptr<const tree_snapshot> snapshot_holder::acquire() const
+{
+	size_t slot;
+	published* record = readers.protect(current, slot);
+	shared_ptr<const tree_snapshot> snapshot = record != nullptr ? record->snapshot : nullptr;
+	readers.leave(slot);
+	return snapshot;
+}
+
+// a retired record no reader is following can go; its snapshot then can
+// not be reached anymore, so once only the retired list references it,
+// it stays unused and can go too
+void snapshot_holder::free_unused()
+{
+	auto record = retired_records.begin();
+	while (record != retired_records.end()) {
+		if (readers.in_use(*record)) {
+			++record;
+			continue;
+		}
+		retired.push_back(move((*record)->snapshot));
+		delete *record;
+		record = retired_records.erase(record);
+	}
+
+	retired.erase(remove_if(retired.begin(), retired.end(),
+		[](const shared_ptr<const tree_snapshot>& s) { return s.use_count() == 1; }),
+		retired.end());
+}
+
+void snapshot_holder::publish(shared_ptr<const tree_snapshot> snapshot)
+{
+	lock_guard<mutex> lock(writer);
+	published* old = current.exchange(new published{ move(snapshot) });
+	if (old != nullptr)
+		retired_records.push_back(old);
+	free_unused();
+}
+
+size_t snapshot_holder::reclaim()
+{
+	lock_guard<mutex> lock(writer);
+	free_unused();
+	return retired_records.size() + retired.size();
+}
+
+bool snapshot_holder::reload(const string& file_name, bool compact)
+{
+	fstream source(file_name.c_str(), ios_base::in);
+	if (source.fail())
+		return false;
+
+	token_parser parser(source);
+	parser.set_compact(compact);
+	if (!parser.tokenize() || !parser.parse())
+		return false;
+
+	publish(parser.freeze());
+	return true;
+}
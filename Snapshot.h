@@ -0,0 +1,135 @@
+#ifndef __SNAPSHOT_DEFINED__
+#define __SNAPSHOT_DEFINED__
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "Tokenizer.h"
+
+using namespace std;
+
+// A frozen copy of a parsed tree. It has no setters and no links to the
+// nodes it was made from, so any number of threads can read it at the same
+// time without locks. The nodes are stored in document order with the
+// root first; the children of a node follow each other in a single index
+// table. Ids are numbered as print_file() does, also for compact trees.
+
+class tree_snapshot
+{
+public:
+	static const size_t npos = (size_t)-1;
+
+	struct frozen_node
+	{
+		int id;
+		size_t parent;				// npos for the root
+		size_t first_child;			// into the child table
+		size_t child_count;
+		string name;
+		string data;
+		uint64_t hash;
+	};
+private:
+	vector<frozen_node> nodes;
+	vector<size_t> children;
+
+	size_t add_node(node* n, size_t parent);
+public:
+	static shared_ptr<const tree_snapshot> freeze(shared_ptr<node> root);
+
+	size_t size() const { return nodes.size(); }
+	const frozen_node& at(size_t i) const { return nodes[i]; }
+	// index of the k-th child of node i
+	size_t child(size_t i, size_t k) const { return children[nodes[i].first_child + k]; }
+	// index of the first node at a path like "shape.vertices", or npos
+	size_t find(const string& path) const;
+};
+
+// Slots in which reader threads announce the pointer they are about to
+// follow, so a writer replacing it does not free it meanwhile. A reader
+// takes a free slot with protect() and gives it back with leave(); the
+// writer frees a replaced pointer only once in_use() says no slot has it.
+
+class hazard_slots
+{
+private:
+	struct alignas(64) slot
+	{
+		atomic<const void*> pointer;
+	};
+	static const size_t slot_count = 64;
+	static const char claimed;		// in a slot taken by a reader not following a pointer yet
+
+	mutable slot slots[slot_count];	// nullptr when free
+
+	size_t take() const;
+public:
+	hazard_slots();
+	hazard_slots(const hazard_slots&) = delete;
+	hazard_slots& operator=(const hazard_slots&) = delete;
+
+	// the pointer in current, announced in the slot returned in taken
+	template<typename T>
+	T* protect(const atomic<T*>& current, size_t& taken) const
+	{
+		taken = take();
+		// announce the pointer, then check it is still the current one: if
+		// so, the writer sees the slot before it could free it
+		T* pointer = current.load();
+		while (true) {
+			slots[taken].pointer.store(pointer != nullptr ? (const void*)pointer : &claimed);
+			T* again = current.load();
+			if (again == pointer)
+				return pointer;
+			pointer = again;
+		}
+	}
+	void leave(size_t taken) const { slots[taken].pointer.store(nullptr); }
+	bool in_use(const void* pointer) const;
+};
+
+// Hands the current snapshot to reader threads and swaps in new ones, in
+// the manner of RCU: readers take a reference with acquire() and never wait
+// for a reload, which is done completely before publish() swaps the
+// pointer. Readers take no lock: the current snapshot is behind an atomic
+// pointer, and a reader announces the pointer it is about to follow in a
+// hazard slot, so the writer does not free it meanwhile. A replaced
+// snapshot is kept until no reader holds it anymore and is then freed by
+// the writer side, so readers never pay for freeing a whole tree.
+
+class snapshot_holder
+{
+private:
+	struct published
+	{
+		shared_ptr<const tree_snapshot> snapshot;
+	};
+
+	atomic<published*> current;
+	hazard_slots readers;
+	vector<published*> retired_records;		// replaced, maybe still followed by a reader
+	vector<shared_ptr<const tree_snapshot> > retired;
+	mutex writer;					// taken by publishers only, never by readers
+
+	void free_unused();
+public:
+	snapshot_holder();
+	~snapshot_holder();
+	snapshot_holder(const snapshot_holder&) = delete;
+	snapshot_holder& operator=(const snapshot_holder&) = delete;
+
+	shared_ptr<const tree_snapshot> acquire() const;
+	void publish(shared_ptr<const tree_snapshot> snapshot);
+	// free the retired snapshots no reader holds anymore, returns how many are left
+	size_t reclaim();
+	// parse file_name and publish the result, false if it could not be read
+	// or parsed; the current snapshot stays then
+	bool reload(const string& file_name, bool compact = false);
+};
+
+#endif
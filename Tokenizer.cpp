@@ -30,14 +30,143 @@
 #include <list>
 #include <stack>
 #include <cctype>
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 
 #include "Tokenizer.h"
+#include "Emitter.h"
+#include "Serializer.h"
+#include "Snapshot.h"
 
 
+// read the next block of the source
+bool source_reader::fill()
+{
+	if (stream == nullptr)
+		return false;
+	base += end;
+	next = 0;
+	stream->read(buffer.data(), buffer.size());
+	end = (size_t)stream->gcount();
+	return end > 0;
+}
+
+// the comment skipping searches the buffer with memchr instead of
+// reading it character by character
+bool source_reader::skip_past(char c)
+{
+	while (next < end || fill()) {
+		const char* found = (const char*)memchr(window + next, c, end - next);
+		if (found != nullptr) {
+			next = found - window + 1;
+			return true;
+		}
+		next = end;
+	}
+	at_eof = true;
+	return false;
+}
+
+bool source_reader::skip_block_comment()
+{
+	while (skip_past('*')) {
+		// "**/" ends the comment too, so leave a second '*' to be found again
+		int c = peek();
+		if (c == '/') {
+			get();
+			return true;
+		}
+	}
+	return false;
+}
+
+// braces in literals and comments do not count, no tokens are made
+bool source_reader::skip_block(bool comments)
+{
+	int depth = 1;
+	while (true) {
+		int c = get();
+		switch (c) {
+		case EOF:
+			return false;
+		case '{':
+			++depth;
+			break;
+		case '}':
+			if (--depth == 0)
+				return true;
+			break;
+		case '\"':
+		case '\'':
+			// a backslash escapes the next character of a literal
+			for (int q = get(); q != c; q = get()) {
+				if (q == EOF)
+					return false;
+				if (q == '\\')
+					get();
+			}
+			break;
+		case '/':
+			if (!comments)
+				break;
+			if (peek() == '/')
+				skip_past(0x0A);
+			else if (peek() == '*') {
+				get();
+				if (!skip_block_comment())
+					return false;
+			}
+			break;
+		}
+	}
+}
+
+// note the start of every line beginning in p[0..n), p is at offset
+void source_reader::add_line_starts(const char* p, size_t n, size_t offset)
+{
+	const char* block = p;
+	const char* block_end = p + n;
+	while ((p = (const char*)memchr(p, 0x0A, block_end - p)) != nullptr) {
+		++p;
+		line_starts.push_back(offset + (p - block));
+	}
+}
+
+// offset => "line:column", both counted from 1
+string source_reader::location(size_t offset)
+{
+	if (line_starts.empty()) {
+		// scan the whole source once for line breaks
+		line_starts.push_back(0);
+		if (stream == nullptr)
+			add_line_starts(window, end, 0);
+		else {
+			// leave the stream where it was so reading can go on
+			stream->clear();
+			streampos resume = stream->tellg();
+			stream->seekg(0);
+
+			vector<char> block(1 << 16);
+			size_t block_base = 0;
+			while (stream->read(block.data(), block.size()) || stream->gcount() > 0) {
+				size_t n = (size_t)stream->gcount();
+				add_line_starts(block.data(), n, block_base);
+				block_base += n;
+			}
+
+			stream->clear();
+			stream->seekg(resume);
+		}
+	}
+
+	size_t line = upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin();
+	return std::to_string(line) + ":" + std::to_string(offset - line_starts[line - 1] + 1);
+}
+
 // parse the rest of a symbol
-int symbol_token::parse_token(fstream& stream, int input_char) {
+int symbol_token::parse_token(source_reader& stream, int input_char) {
 	symbol = input_char;
 	while (true) {
 		input_char = stream.get();
@@ -55,7 +184,7 @@ void symbol_token::print_token() {
 }
 
 // parse the rest of an integer
-int integer_token::parse_token(fstream& stream, int input_char) {
+int integer_token::parse_token(source_reader& stream, int input_char) {
 	integer_string = input_char;
 	if (input_char == '0')
 	{
@@ -77,8 +206,8 @@ int integer_token::parse_token(fstream& stream, int input_char) {
 			// if no space after a number, then symbol is illegal
 			if (input_char != ' ' && input_char != 0x09 && input_char != 0x0B && input_char != 0x0D)
 			{
-				cout << (size_t)stream.tellg() - 1 << ": Illegal symbol. Exit." << endl;
-				exit(-1);
+				cout << stream.location(stream.tell() - 1) << ": Illegal symbol." << endl;
+				return error;
 			}
 		}
 	}
@@ -98,7 +227,7 @@ void integer_token::print_token() {
 }
 
 // parse the rest of a literal
-int literal_token::parse_token(fstream& stream, int input_char) {
+int literal_token::parse_token(source_reader& stream, int input_char) {
 	literal_string.clear();
 	while (true) {
 		input_char = stream.get();
@@ -111,12 +240,12 @@ int literal_token::parse_token(fstream& stream, int input_char) {
 				continue;
 			}
 			if (input_char == 0x0A) {
-				cout << "error: EOL encountered before closing literal quotes" << endl;
-				exit(0);
+				cout << stream.location(get_pos()) << ": EOL encountered before closing literal quotes." << endl;
+				return error;
 			}
 			if (input_char == -1) {
-				cout << "error: EOF encountered before closing literal quotes" << endl;
-				exit(0);
+				cout << stream.location(get_pos()) << ": EOF encountered before closing literal quotes." << endl;
+				return error;
 			}
 			literal_string += input_char;
 			continue;
@@ -126,8 +255,8 @@ int literal_token::parse_token(fstream& stream, int input_char) {
 			continue;
 		}
 		if (input_char == -1) {
-			cout << "error: EOF encountered before closing literal quotes" << endl;
-			exit(0);
+			cout << stream.location(get_pos()) << ": EOF encountered before closing literal quotes." << endl;
+			return error;
 		}
 		input_char = stream.get();
 		return input_char;
@@ -140,7 +269,7 @@ void literal_token::print_token() {
 }
 
 // parse the rest of a literal
-int const_literal_token::parse_token(fstream& stream, int input_char) {
+int const_literal_token::parse_token(source_reader& stream, int input_char) {
 	const_literal_string.clear();
 	while (true) {
 		input_char = stream.get();
@@ -152,13 +281,25 @@ int const_literal_token::parse_token(fstream& stream, int input_char) {
 				const_literal_string += input_char;
 				continue;
 			}
+			if (input_char == 0x0A) {
+				cout << stream.location(get_pos()) << ": EOL encountered before closing literal quotes." << endl;
+				return error;
+			}
+			if (input_char == -1) {
+				cout << stream.location(get_pos()) << ": EOF encountered before closing literal quotes." << endl;
+				return error;
+			}
 			const_literal_string += input_char;
 			continue;
 		}
-		if (input_char != '\'') {
+		if (input_char != '\'' && input_char != -1) {
 			const_literal_string += input_char;
 			continue;
 		}
+		if (input_char == -1) {
+			cout << stream.location(get_pos()) << ": EOF encountered before closing literal quotes." << endl;
+			return error;
+		}
 		input_char = stream.get();
 		return input_char;
 	}
@@ -174,7 +315,7 @@ void const_literal_token::print_token() {
 // punctuation string. NB: The sequence .. is accepted as a 
 // punctuation token, but must be rejected by the compiler at
 // some later stage.
-int punctuation_token::parse_token(fstream& stream, int input_char) {
+int punctuation_token::parse_token(source_reader& stream, int input_char) {
 	punctuation_string = input_char;
 	switch (input_char) {
 	case '!': // Looking for either ! or !=
@@ -320,7 +461,7 @@ void punctuation_token::print_token() {
 }
 
 // parse the whitespace characters
-int whitespace_token::parse_token(fstream& stream, int input_char) {
+int whitespace_token::parse_token(source_reader& stream, int input_char) {
 	while (true) {
 		input_char = stream.get();
 		if (input_char == ' ' || input_char == 0x09 || input_char == 0x0B || input_char == 0x0D) {
@@ -336,7 +477,7 @@ void whitespace_token::print_token() {
 }
 
 // parse the eol character
-int eol_token::parse_token(fstream& stream, int input_char) {
+int eol_token::parse_token(source_reader& stream, int input_char) {
 	while (true) {
 		input_char = stream.get();
 		return input_char;
@@ -349,7 +490,7 @@ void eol_token::print_token() {
 }
 
 // parse the eof character
-int eof_token::parse_token(fstream& stream, int input_char) {
+int eof_token::parse_token(source_reader& stream, int input_char) {
 	return 0;
 }
 
@@ -359,7 +500,7 @@ void eof_token::print_token(void) {
 }
 
 // parse the invalid character
-int invalid_token::parse_token(fstream& stream, int input_char) {
+int invalid_token::parse_token(source_reader& stream, int input_char) {
 	invalid_character = input_char;
 	input_char = stream.get();
 	return input_char;
@@ -370,138 +511,247 @@ void invalid_token::print_token(void) {
 	cout << "TOKEN[\"INVALID\"" << invalid_character << endl;
 }
 
+// read the next token of the source, whitespace and EOL are skipped
+// returns the EOF token at the end and nullptr on an invalid character,
+// an unterminated block comment or a token that cannot be completed
+shared_ptr<base_token> token_parser::read_token() {
+	if (input_char == no_char)
+		input_char = source_stream.get();
+
+	// Determine what the leading character is of the sequence,
+	// create an appropriate token and get the actual token
+	// class to parse the rest of it (if any)
+
+	while (!source_stream.eof()) {
+		// Remove any comments from the source
+		if (input_char == '/' && comments) {
+			int peek_character = source_stream.peek();
+			if (peek_character == '/') {
+				// Remove the line comment, the EOL goes with it
+				source_stream.skip_past(0x0A);
+				input_char = source_stream.get();
+				continue;
+			}
+			if (peek_character == '*') {
+				// Remove a block comment
+				size_t comment_start = source_stream.tell() - 1;
+				source_stream.get();
+				if (!source_stream.skip_block_comment()) {
+					cout << source_stream.location(comment_start) << ": Block comment not terminated before EOF." << endl;
+					return nullptr;
+				}
+				input_char = source_stream.get();
+				continue;
+			}
+		}
+
+		shared_ptr<base_token> token;
+
+		do
+		{
+			// use (nothrow) to prevent exceptions => instead nullptr will be returned in case of errors
+			if (isalpha(input_char) || input_char == '_') {
+				// Start of a symbol sequence
+				token = make_shared<symbol_token>();
+				break;
+			}
+			if (input_char == 0x0A) {
+				// EOL
+				token = make_shared<eol_token>();
+				break;
+			}
+			if (isspace(input_char)) {
+				// Start of whitespace sequence
+				token = make_shared<whitespace_token>();
+				break;
+			}
+			if (input_char == '\"') {
+				// Start of literal sequence
+				token = make_shared<literal_token>();
+				break;
+			}
+			if (input_char == '\'') {
+				// Start of constant literal sequence
+				token = make_shared<const_literal_token>();
+				break;
+			}
+			if (isdigit(input_char)) {
+				// Start of number sequence
+				token = make_shared<integer_token>();
+				break;
+			}
+			if (ispunct(input_char)) {
+				// Start of punctuation sequence
+				token = make_shared<punctuation_token>();
+				break;
+			}
+		} while (false);
+
+		if (token == nullptr) {
+			cout << source_stream.location(source_stream.tell() - 1) << ": Invalid character." << endl;
+			return nullptr;
+		}
+
+		// save position in stream of the current token
+		token->set_pos(source_stream.tell() - 1);
+
+		// start parsing it
+		input_char = token->parse_token(source_stream, input_char);
+		if (input_char == base_token::error)
+			return nullptr;
+		// the character after the token is taken already, unless at the end
+		token->set_end(input_char == -1 ? source_stream.tell() : source_stream.tell() - 1);
+
+		// ignore whitespaces and EOL for better performance when parsing is done later
+		if ((token->type() != base_token::t_whitespace)
+			&& (token->type() != base_token::t_eol))
+			return token;
+	}
+	return make_shared<eof_token>();
+}
+
 // parse the input source
 bool token_parser::tokenize() {
+	if (!projection.empty())
+		return tokenize_projection();
+
+	// in compact mode parse() takes the tokens as they are read
+	if (compact) {
+		streaming = true;
+		lookahead = read_token();
+		return lookahead != nullptr;
+	}
+
 	shared_ptr<base_token> token;
 
-	while (!source_stream.eof()) {
-		int input_char = source_stream.get();
+	// append tokens to the the list up to and including the EOF token
+	while ((token = read_token()) != nullptr) {
+		token_list.push_back(token);
+		if (token->type() == base_token::t_eof)
+			break;
+	}
 
-		// Determine what the leading character is of the sequence,
-		// create an appropriate token and get the actual token
-		// class to parse the rest of it (if any)
+	node_iterator = token_list.begin();
+	return token != nullptr;
+}
 
-		while (!source_stream.eof()) {
-			do
-			{
-				// Remove any comments from the source
-				//if (input_char == '/') {
-				//	int peek_character = source_stream.peek();
-				//	if (peek_character == '/') {
-				//		// Remove the line comment
-				//		while (peek_character != 0x0A && !source_stream.eof()) {
-				//			peek_character = source_stream.get();
-				//		}
-				//		token = new(nothrow) eol_token;
-				//		break;
-				//	}
-				//	if (peek_character == '*') {
-				//		// Remove a block comment
-				//		while (true) {
-				//			peek_character = source_stream.get();
-				//			if (peek_character == -1) {
-				//				cout << "error: block comment not terminated before EOF" << endl;
-				//				exit(0);
-				//			}
-				//			if (peek_character == 0x0A) {
-				//				token = new(nothrow) eol_token;
-				//				// Add the token to the end of the list
-				//				token_list.push_back(token);
-				//				continue;
-				//			}
-				//			if (peek_character == '*') {
-				//				peek_character = source_stream.get();
-				//				if (peek_character == -1) {
-				//					cout << "error: block comment not terminated before EOF" << endl;
-				//					exit(0);
-				//				}
-				//				if (peek_character == '/') {
-				//					// We need to ensure that a whitespace token
-				//					// is created to ensure /* */ in the middle
-				//					// of a source line is processed correctly.
-				//					input_char = source_stream.get();
-				//					input_char = ' ';
-				//					token = new(nothrow) whitespace_token;
-				//					break;
-				//				}
-				//			}
-				//		}
-				//	}
-				//}
-
-				// use (nothrow) to prevent exceptions => instead nullptr will be returned in case of errors
-				if (isalpha(input_char) || input_char == '_') {
-					// Start of a symbol sequence
-					token = make_shared<symbol_token>();
-					break;
-				}
-				if (input_char == 0x0A) {
-					// EOL
-					token = make_shared<eol_token>();
-					break;
-				}
-				if (isspace(input_char)) {
-					// Start of whitespace sequence
-					token = make_shared<whitespace_token>();
-					break;
-				}
-				if (input_char == '\"') {
-					// Start of literal sequence
-					token = make_shared<literal_token>();
-					break;
-				}
-				if (input_char == '\'') {
-					// Start of constant literal sequence
-					token = make_shared<const_literal_token>();
-					break;
-				}
-				if (isdigit(input_char)) {
-					// Start of number sequence
-					token = make_shared<integer_token>();
-					break;
-				}
-				if (ispunct(input_char)) {
-					// Start of punctuation sequence
-					token = make_shared<punctuation_token>();
-					break;
-				}
-			} while (false);
+// 2 if path is wanted with everything below it, 1 if it leads to a
+// wanted path, 0 if it is not wanted
+int token_parser::projection_match(const string& path)
+{
+	int match = 0;
+	for (auto& wanted : projection) {
+		if (wanted.compare(0, path.size(), path) == 0) {
+			if (wanted.size() == path.size())
+				return 2;
+			if (wanted[path.size()] == '.')
+				match = 1;
+		}
+		else if (path.size() > wanted.size() && path.compare(0, wanted.size(), wanted) == 0 && path[wanted.size()] == '.')
+			return 2;
+	}
+	return match;
+}
 
-			if (token == nullptr) 
-				return false;
+// skip the block opened by the token just read, input_char is the
+// character after its '{'
+bool token_parser::skip_block(shared_ptr<base_token> open)
+{
+	if (input_char != EOF)
+		source_stream.unget();
+	if (input_char == EOF || !source_stream.skip_block(comments)) {
+		cout << source_stream.location(open->get_pos()) << ": Block not closed before EOF." << endl;
+		return false;
+	}
+	input_char = no_char;
+	return true;
+}
 
-			// save position in stream of the current token
-			token->set_pos((size_t)source_stream.tellg() - 1);
+// tokenize() with a projection: "name = value" and "name = { ... }" off
+// the wanted paths leave no tokens, the blocks are skipped in the source
+bool token_parser::tokenize_projection() {
+	// paths of the open blocks leading to wanted ones, with their name tokens
+	vector<pair<string, list<shared_ptr<base_token> >::iterator> > path;
+	int inside = 0;					// blocks open inside a block wanted as a whole
+	shared_ptr<base_token> token;
 
-			// start parsing it
-			input_char = token->parse_token(source_stream, input_char);
+	while ((token = read_token()) != nullptr) {
+		token_list.push_back(token);
+		if (token->type() == base_token::t_eof)
+			break;
+		if (token->type() != base_token::t_punctuation)
+			continue;
 
-			// append token to the the list
-			// ignore whitespaces and EOL for better performance when parsing is done later
-			if ((token->type() != base_token::t_whitespace)
-				&& (token->type() != base_token::t_eol))
-				token_list.push_back(token);
+		string_view val = token->get_value();
+		if (val == "}") {
+			if (inside > 0)
+				--inside;
+			else if (!path.empty()) {
+				// none of the wanted paths is in the block: "name = { }" is
+				// no valid block, so it goes as a whole
+				auto symbol = path.back().second;
+				if (next(symbol, 3) == prev(token_list.end()))
+					token_list.erase(symbol, token_list.end());
+				path.pop_back();
+			}
+			continue;
+		}
+		if (val != "=" || token_list.size() < 2)
+			continue;
+		auto symbol = prev(token_list.end(), 2);
+		if ((*symbol)->type() != base_token::t_symbol)
 			continue;
+
+		shared_ptr<base_token> value = read_token();
+		if (value == nullptr) {
+			token = nullptr;
+			break;
+		}
+		bool block = value->type() == base_token::t_punctuation && value->get_value() == "{";
+		bool leaf = value->type() == base_token::t_literal || value->type() == base_token::t_integer
+			|| value->type() == base_token::t_const_literal;
+
+		if (inside > 0) {
+			if (block)
+				++inside;
+		}
+		else {
+			string name = path.empty() ? string((*symbol)->get_value()) : path.back().first + "." + string((*symbol)->get_value());
+			int match = projection_match(name);
+			if (match == 0 && (block || leaf)) {
+				token_list.erase(symbol, token_list.end());
+				if (block && !skip_block(value)) {
+					token = nullptr;
+					break;
+				}
+				continue;
+			}
+			if (block) {
+				if (match == 2)
+					inside = 1;
+				else
+					path.push_back(make_pair(name, symbol));
+			}
 		}
+
+		// anything else is left to parse() to report
+		token_list.push_back(value);
+		if (value->type() == base_token::t_eof)
+			break;
 	}
-	// Add the EOF token to the end of the list
-	token = make_shared<eof_token>();
-	if (token != nullptr)
-		token_list.push_back(token);
 
 	node_iterator = token_list.begin();
-	return true;
+	return token != nullptr;
 }
 
 // this is the part responsible for syntax analysis
-void token_parser::parse()
+bool token_parser::parse()
 {
 	int id = 1;
 
-	//node* parent_node = new node(id);		// this is the root node
-	shared_ptr<node> parent_node(new node(id));
-	//node* tmp_node = parent_node;			// will hold the parent node during parsing
-	shared_ptr<node> tmp_node = parent_node;
+	shared_ptr<node> tmp_node(new node(id));	// this is the root node
+	shared_ptr<node> parent_node;					// the block tmp_node is in
+	vector<shared_ptr<node> > open_blocks;			// the blocks around parent_node
 
 	node_list.push_back(tmp_node);		// a list of parsing result
 
@@ -512,17 +762,17 @@ void token_parser::parse()
 
 	while (((tok = get_next()) != nullptr) && tok->type() != base_token::t_eof)
 	{
-		string val = tok->get_value();
+		string_view val = tok->get_value();
 		next = peek_next();
+		// a token that could not be read has been reported already
+		if (next == nullptr)
+			return parse_failed();
+
 		switch (tok->type())
 		{
 			case base_token::t_symbol:
-				if (next == nullptr)
-				{
-					parse_error("=", "nullptr", next->get_pos());
-				}
-
-				tmp_node->set_name(val);
+				tmp_node->set_name(string(val));
+				tmp_node->set_source_begin(tok->get_pos());
 
 				if (next->type() == base_token::t_punctuation)
 				{
@@ -532,12 +782,12 @@ void token_parser::parse()
 					}
 					else
 					{
-						parse_error("=", next->get_value(), next->get_pos());
+						return parse_error("=", next->get_value(), next->get_pos());
 					}
 				}
 				else
 				{
-					parse_error("=", next->get_value(), next->get_pos());
+					return parse_error("=", next->get_value(), next->get_pos());
 				}
 				
 				continue;
@@ -548,45 +798,52 @@ void token_parser::parse()
 					if (next->type() == base_token::t_symbol)
 					{
 						shared_ptr<node> new_elem (new node(++id));
-						new_elem->add_parent(tmp_node);
+						new_elem->add_parent(tmp_node.get());
 						tmp_node->add_child(new_elem);
 						node_list.push_back(new_elem);
+						open_blocks.push_back(parent_node);
 						parent_node = tmp_node;
 						tmp_node = new_elem;
 						continue;
 					}
 					else
 					{
-						parse_error("a symbol", next->get_value(), next->get_pos());
+						return parse_error("a symbol", next->get_value(), next->get_pos());
 					}
 				}
 				else if (val == "}")
 				{
-					// go back to parent node
-					if (tmp_node != parent_node)
-						tmp_node = parent_node->get_parent();
+					// the block of parent_node is closed, go back to its parent
+					if (parent_node == nullptr)
+						return parse_error("End of file", val, tok->get_pos());
+					// all of its children are complete now
+					parent_node->set_source_end(tok->get_end());
+					parent_node->update_hash();
+					tmp_node = parent_node;
+					parent_node = open_blocks.back();
+					open_blocks.pop_back();
+					tmp_node = share_subtree(tmp_node);
 					if (next->type() == base_token::t_symbol)
 					{
-						if (tmp_node != nullptr)
+						if (parent_node != nullptr)
 						{
 							shared_ptr<node> new_elem(new node(++id));
-							new_elem->add_parent(tmp_node);
-							tmp_node->add_child(new_elem);
+							new_elem->add_parent(parent_node.get());
+							parent_node->add_child(new_elem);
 							node_list.push_back(new_elem);
 							tmp_node = new_elem;
 							continue;
 						}
 						else
 						{
-							parse_error("End of file (should have only 1 root element)", "another root element", next->get_pos());
+							return parse_error("End of file (should have only 1 root element)", "another root element", next->get_pos());
 						}
 					}
 					else if (next->type() == base_token::t_punctuation)
 					{
 						if (next->get_value() == "}")
 						{
-							// go one level up for parent node
-							parent_node = parent_node->get_parent();
+							// the enclosing block is closed by the next token
 							continue;
 						}
 					}
@@ -596,7 +853,7 @@ void token_parser::parse()
 						continue;
 					}
 					
-					parse_error("a symbol or }", next->get_value(), next->get_pos());
+					return parse_error("a symbol or }", next->get_value(), next->get_pos());
 				}
 				else if (val == "=")
 				{
@@ -609,7 +866,7 @@ void token_parser::parse()
 						}
 						else
 						{
-							parse_error("{", next->get_value(), next->get_pos());
+							return parse_error("{", next->get_value(), next->get_pos());
 						}
 					}
 					else if (next->type() == base_token::t_literal || next->type() == base_token::t_const_literal || next->type() == base_token::t_integer)
@@ -620,7 +877,7 @@ void token_parser::parse()
 					else 
 					{
 						// not a valid token
-						parse_error("{ or \"value\"", next->get_value(), next->get_pos());
+						return parse_error("{ or \"value\"", next->get_value(), next->get_pos());
 					}
 				}
 				break;
@@ -628,14 +885,17 @@ void token_parser::parse()
 			case base_token::t_literal:
 			case base_token::t_integer:
 			case base_token::t_const_literal:
-				tmp_node->set_data(val);
+				tmp_node->set_data(string(val), tok->type());
+				tmp_node->set_source_end(tok->get_end());
+				tmp_node->update_hash();
+				tmp_node = share_subtree(tmp_node);
 				// if next symbol, create new elem
 				if (next->type() == base_token::t_symbol)
 				{
 					if (tmp_node->get_parent() != nullptr)
 					{
 						shared_ptr<node> new_elem(new node(++id));
-						new_elem->add_parent(parent_node);
+						new_elem->add_parent(parent_node.get());
 						parent_node->add_child(new_elem);
 						node_list.push_back(new_elem);
 						tmp_node = new_elem;
@@ -643,7 +903,7 @@ void token_parser::parse()
 					}
 					else
 					{
-						parse_error("End of file (should have only 1 root element)", "another root element", next->get_pos());
+						return parse_error("End of file (should have only 1 root element)", "another root element", next->get_pos());
 					}
 				}
 				else if (next->type() == base_token::t_punctuation)
@@ -659,17 +919,77 @@ void token_parser::parse()
 					// in case node = "value" as root element
 					continue;
 				}
-				parse_error("symbol or }", next->get_value(), next->get_pos());
+				return parse_error("symbol or }", next->get_value(), next->get_pos());
 				break;
 
 			default:
 				break;
 		}
 	}
+
+	// the tokens are not needed anymore, a compact projection frees them
+	if (compact) {
+		token_list.clear();
+		node_iterator = token_list.begin();
+	}
+	return true;
+}
+
+// same name, data and children, nodes already shared are compared by address
+static bool same_subtree(node* a, node* b)
+{
+	if (a == b)
+		return true;
+	if (a->get_hash() != b->get_hash() || a->get_name() != b->get_name()
+		|| a->get_data() != b->get_data() || a->get_data_type() != b->get_data_type()
+		|| a->child_count() != b->child_count())
+		return false;
+
+	auto b_it = b->get_children().begin();
+	for (auto& child : a->get_children()) {
+		if (!same_subtree(child.get(), (b_it++)->get()))
+			return false;
+	}
+	return true;
+}
+
+// compact mode: n has just been completed, if an equal subtree was seen
+// before, that one takes the place of n in its parent
+shared_ptr<node> token_parser::share_subtree(shared_ptr<node> n)
+{
+	node* parent = n->get_parent();
+	if (!compact || parent == nullptr)
+		return n;
+
+	auto found = shared_subtrees.insert(make_pair(n->get_hash(), n));
+	if (found.second)
+		return n;	// the first one of its kind
+	shared_ptr<node> first = found.first->second;
+	if (!same_subtree(first.get(), n.get()))
+		return n;
+
+	// the nodes of n are the last ones created
+	while (node_list.back() != n)
+		node_list.pop_back();
+	node_list.pop_back();
+
+	parent->replace_last_child(first);
+	return first;
+}
+
+shared_ptr<const tree_snapshot> token_parser::freeze()
+{
+	return tree_snapshot::freeze(get_root());
 }
 
 shared_ptr<base_token> token_parser::get_next()
 {
+	if (streaming) {
+		shared_ptr<base_token> token = move(lookahead);
+		if (token != nullptr && token->type() != base_token::t_eof)
+			lookahead = read_token();
+		return token;
+	}
 	if (node_iterator != token_list.end())
 		return (*node_iterator++);
 	else
@@ -678,16 +998,26 @@ shared_ptr<base_token> token_parser::get_next()
 
 shared_ptr<base_token> token_parser::peek_next()
 {
+	if (streaming)
+		return lookahead;
 	if ((*node_iterator) != nullptr && std::next(node_iterator, 0) != token_list.end())
 		return (*std::next(node_iterator, 0));
 	else
 		return nullptr;
 }
 
-void token_parser::parse_error(string expected, string got, size_t pos)
+bool token_parser::parse_error(string_view expected, string_view got, size_t pos)
 {
-	cout << "At " << pos << ": Expected '" << expected << "', got '" << got << "'. Exit." << endl;
-	exit(-1);
+	cout << "At " << source_stream.location(pos) << ": Expected '" << expected << "', got '" << got << "'." << endl;
+	return parse_failed();
+}
+
+// drop the nodes made so far, the error has been printed
+bool token_parser::parse_failed()
+{
+	node_list.clear();
+	shared_subtrees.clear();
+	return false;
 }
 
 // for debug purposes this might be useful
@@ -700,7 +1030,7 @@ void token_parser::print_tokens() {
 	}
 }
 
-void token_parser::print_file(string file_name)
+void token_parser::print_file(string file_name, output_format format)
 {
 	std::streambuf* coutbuf = std::cout.rdbuf();
 	ofstream out(file_name);
@@ -715,15 +1045,61 @@ void token_parser::print_file(string file_name)
 	}
 	
 	// print to file/console
-	auto n_it = node_list.begin();
-	while (n_it != node_list.end())
+	node_emitter emitter(std::cout);
+	switch (format)
 	{
-		std::cout << (*n_it++)->to_string();
+		case f_json:
+			emitter.emit_json(get_root());
+			break;
+		case f_csv:
+			if (compact)
+				emitter.emit_table(get_root(), ',');
+			else
+				emitter.emit_table(node_list, ',');
+			break;
+		case f_tsv:
+			if (compact)
+				emitter.emit_table(get_root(), '\t');
+			else
+				emitter.emit_table(node_list, '\t');
+			break;
+		case f_source:
+			tree_serializer(true).write(get_root(), std::cout);
+			break;
+		default:
+			if (compact)
+				emitter.emit_tuples(get_root());
+			else
+				emitter.emit_tuples(node_list);
+			break;
 	}
 
 	std::cout.rdbuf(coutbuf);
 }
 
+// 64 bit FNV-1a over the bytes of s, continuing from h
+static uint64_t hash_string(const string& s, uint64_t h)
+{
+	for (unsigned char c : s) {
+		h ^= c;
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+// the hash covers name, data and the (already computed) hashes of all
+// children in order, so equal hashes mean equal subtrees
+void node::update_hash()
+{
+	uint64_t h = hash_string(name, 0xCBF29CE484222325ULL);
+	// separate name from data, so ("ab", "c") differs from ("a", "bc")
+	h = hash_string(data, h ^ name.size());
+	for (auto& child : children) {
+		h ^= child->hash + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+	}
+	hash = h;
+}
+
 string node::to_string()
 {
 	// format (node_id, parent_id, name, data) => (1, 0, shape, )
@@ -4,10 +4,66 @@
 #pragma once
 
 #include <fstream>
+#include <string>
+#include <string_view>
 #include <list>
+#include <memory>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
 
 using namespace std;
 
+// Buffered reader for the source. It counts the characters taken, so the
+// position of a token is known without asking the stream (tellg() is slow
+// on an fstream). Offsets are turned into line:column only when a
+// diagnostic needs them.
+
+class source_reader
+{
+private:
+	istream* stream;				// nullptr when reading from memory
+	vector<char> buffer;
+	const char* window;				// the buffer, or the whole source in memory
+	size_t next;					// index of the next character in window
+	size_t end;						// number of valid characters in window
+	size_t base;					// source offset of window[0]
+	bool at_eof;
+	vector<size_t> line_starts;		// offsets of all lines, built on first use
+
+	bool fill();
+	void add_line_starts(const char* p, size_t n, size_t offset);
+public:
+	source_reader(istream& s) : stream(&s), buffer(1 << 16), window(buffer.data()), next(0), end(0), base(0), at_eof(false) { };
+	source_reader(const char* data, size_t size) : stream(nullptr), window(data), next(0), end(size), base(0), at_eof(false) { };
+
+	int get() {
+		if (next == end && !fill()) {
+			at_eof = true;
+			return EOF;
+		}
+		return (unsigned char)window[next++];
+	}
+	int peek() {
+		if (next == end && !fill()) {
+			at_eof = true;
+			return EOF;
+		}
+		return (unsigned char)window[next];
+	}
+	bool eof() { return at_eof; }
+	size_t tell() { return base + next; }	// offset of the next character
+	// skip past the next c, or to the end of the source if there is none
+	bool skip_past(char c);
+	// skip past the next "*/"
+	bool skip_block_comment();
+	// skip past the '}' closing a block whose '{' has been taken
+	bool skip_block(bool comments);
+	// give back the character just taken with get()
+	void unget() { --next; }
+	string location(size_t offset);
+};
+
 // All tokens must derive from this token type
 
 class base_token
@@ -22,15 +78,23 @@ public:
 private:
 	type_of_token token_type;
 	size_t pos;
+	size_t end_pos;
 public:
-	base_token(type_of_token token) : token_type(token), pos(0) { };
-	type_of_token type() { return token_type; }
+	// returned by parse_token() for a token that cannot be completed,
+	// after the error has been printed
+	static const int error = -3;
+
+	base_token(type_of_token token) : token_type(token), pos(0), end_pos(0) { };
+	type_of_token type() const { return token_type; }
 	void set_pos(size_t p) { pos = p; }
-	size_t get_pos() { return pos; }
+	size_t get_pos() const { return pos; }
+	void set_end(size_t p) { end_pos = p; }
+	size_t get_end() const { return end_pos; }		// offset just behind the token
 
-	virtual int parse_token(fstream& stream, int input_char) = 0;
+	virtual int parse_token(source_reader& stream, int input_char) = 0;
 	virtual void print_token() = 0;
-	virtual string get_value() = 0;
+	// the text of the token, valid as long as the token is
+	virtual string_view get_value() const = 0;
 };
 
 // A token that may contain a symbol
@@ -41,8 +105,8 @@ private:
 	string symbol;
 public:
 	symbol_token() : base_token(t_symbol) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return symbol; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return symbol; }
 	void print_token();
 };
 
@@ -54,8 +118,8 @@ private:
 	string integer_string;
 public:
 	integer_token() : base_token(t_integer) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return integer_string; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return integer_string; }
 	void print_token();
 };
 
@@ -67,8 +131,8 @@ private:
 	string literal_string;
 public:
 	literal_token() : base_token(t_literal) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return literal_string; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return literal_string; }
 	void print_token();
 };
 
@@ -80,8 +144,8 @@ private:
 	string const_literal_string;
 public:
 	const_literal_token() : base_token(t_const_literal) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return const_literal_string; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return const_literal_string; }
 	void print_token();
 };
 
@@ -93,8 +157,8 @@ private:
 	string punctuation_string;
 public:
 	punctuation_token() : base_token(t_punctuation) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return punctuation_string; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return punctuation_string; }
 	void print_token();
 };
 
@@ -104,8 +168,8 @@ class whitespace_token : public base_token
 {
 public:
 	whitespace_token() : base_token(t_whitespace) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return ""; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return string_view(); }
 	void print_token();
 };
 
@@ -115,8 +179,8 @@ class eol_token : public base_token
 {
 public:
 	eol_token() : base_token(t_eol) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return ""; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return string_view(); }
 	void print_token();
 };
 
@@ -126,8 +190,8 @@ class eof_token : public base_token
 {
 public:
 	eof_token() : base_token(t_eof) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return ""; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return string_view(); }
 	void print_token();
 };
 
@@ -139,8 +203,8 @@ private:
 	int invalid_character;
 public:
 	invalid_token() : base_token(t_invalid_token), invalid_character(-1) { };
-	int parse_token(fstream& stream, int input_char);
-	string get_value() { return ""; }
+	int parse_token(source_reader& stream, int input_char);
+	string_view get_value() const { return string_view(); }
 	void print_token();
 };
 
@@ -150,41 +214,110 @@ private:
 	int id;
 	string name;
 	string data;
-	shared_ptr<node> parent;
+	base_token::type_of_token data_type;	// the kind of token data was read from
+	uint64_t hash;					// content hash of the whole subtree
+	node* parent;					// not owned, the children own the tree
 	list<shared_ptr<node> > children;
+	size_t source_begin;			// byte range of the node in the source
+	size_t source_end;
+
+	friend class node_query;
+	friend class node_emitter;
+	friend class tree_serializer;
+	friend class parse_cache;
 public:
-	node(int _id) : id(_id), parent(nullptr) { };
-	int get_id() { return id; }
-	void set_name(string s) { name = s; }
-	void set_data(string s) { data = s; }
-	void add_parent(shared_ptr<node> n) { parent = n; }
-	void add_child(shared_ptr<node> n) { children.push_back(n); }
-
-	string get_data() { return data; }
-	string get_name() { return name; }
-
-	shared_ptr<node> get_parent() { return parent; }
-	list<shared_ptr<node> > get_children() { return children; }
+	node(int _id) : id(_id), data_type(base_token::t_literal), hash(0), parent(nullptr), source_begin(0), source_end(0) { };
+	int get_id() const { return id; }
+	void set_name(string s) { name = move(s); }
+	void set_data(string s, base_token::type_of_token t = base_token::t_literal) { data = move(s); data_type = t; }
+	void add_parent(node* n) { parent = n; }
+	void add_child(shared_ptr<node> n) { children.push_back(move(n)); }
+	void replace_last_child(shared_ptr<node> n) { children.back() = move(n); }
+
+	// name and data are valid as long as the node is
+	string_view get_data() const { return data; }
+	string_view get_name() const { return name; }
+	base_token::type_of_token get_data_type() const { return data_type; }
+	void set_source_begin(size_t pos) { source_begin = pos; }
+	void set_source_end(size_t pos) { source_end = pos; }
+	size_t get_source_begin() const { return source_begin; }
+	size_t get_source_end() const { return source_end; }
+	uint64_t get_hash() const { return hash; }
+	void update_hash();
+
+	node* get_parent() const { return parent; }
+	const list<shared_ptr<node> >& get_children() const { return children; }
+	size_t child_count() const { return children.size(); }
 	string to_string();
 };
 
+class tree_snapshot;
+
 // The C++ token parser
 class token_parser
 {
 private:
-	fstream& source_stream;
+	source_reader source_stream;
+	int input_char;					// first character not taken by the last token
 	list<shared_ptr<base_token> > token_list;
 	list<shared_ptr<base_token> >::iterator node_iterator;
 	list<shared_ptr<node> > node_list;
+	bool compact;
+	bool comments;
+	bool streaming;					// parse() reads the tokens itself, see set_compact()
+	shared_ptr<base_token> lookahead;	// the next token while streaming, nullptr after an error
+	unordered_map<uint64_t, shared_ptr<node> > shared_subtrees;	// by content hash
+	vector<string> projection;		// wanted paths, empty for all
+
+	shared_ptr<node> share_subtree(shared_ptr<node> n);
+	int projection_match(const string& path);
+	bool skip_block(shared_ptr<base_token> open);
+	bool tokenize_projection();
+	bool parse_failed();
+
+	friend class parse_cache;
 public:
-	token_parser(fstream& stream) : source_stream(stream) { };
+	typedef enum {
+		f_tuple, f_json, f_csv, f_tsv, f_source
+	} output_format;
+
+	static const int no_char = -2;
+
+	token_parser(istream& stream) : source_stream(stream), input_char(no_char), compact(false), comments(true), streaming(false) { };
+	token_parser(const char* data, size_t size) : source_stream(data, size), input_char(no_char), compact(false), comments(true), streaming(false) { };
+
+	// In compact mode parse() stores equal subtrees only once: the tree
+	// becomes a graph in which the first occurrence of a subtree is shared
+	// by all later ones. node_list then holds only the stored nodes and
+	// the ids of later occurrences exist only in print_file(), which
+	// numbers the nodes as they are visited. Node ids, parents and source
+	// ranges of shared nodes are those of the first occurrence. Without a
+	// projection no token list is built either: tokenize() reads only the
+	// first token and parse() reads the others as it goes, so errors
+	// further on in the source are reported by parse().
+	void set_compact(bool c) { compact = c; }
+	// skip // and /* */ comments like whitespace, on by default
+	void set_comments(bool c) { comments = c; }
+	// Only the nodes on the given paths, such as "shape.color", are
+	// tokenized and parsed, with their ancestors and everything below
+	// them. Other blocks are skipped in the source by counting braces.
+	void set_projection(const vector<string>& paths) { projection = paths; }
+	shared_ptr<base_token> read_token();
 	shared_ptr<base_token> get_next();
 	shared_ptr<base_token> peek_next();
-	void parse_error(string expected, string got, size_t pos);
+	// prints the error and drops the nodes made so far, returns false
+	bool parse_error(string_view expected, string_view got, size_t pos);
+	string location(size_t pos) { return source_stream.location(pos); }
+	// both print the first error in the source and return false on it
 	bool tokenize();
-	void parse();
+	bool parse();
 	void print_tokens();
-	void print_file(string file_name);
+	void print_file(string file_name, output_format format = f_tuple);
+
+	const list<shared_ptr<node> >& get_nodes() { return node_list; }
+	shared_ptr<node> get_root() { return node_list.empty() ? nullptr : node_list.front(); }
+	// a read-only copy of the parsed tree, safe to share between threads
+	shared_ptr<const tree_snapshot> freeze();
 };
 
 #endif
@@ -0,0 +1,276 @@
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+
+#include "Watch.h"
+
+#ifdef __linux__
+// the events that leave a file with new content, or without it
+static const uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM;
+#else
+static const int poll_interval = 50;	// ms between looks at the files
+#endif
+
+file_watcher::file_watcher(int settle_ms) : settle(settle_ms)
+{
+#ifdef __linux__
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+#endif
+}
+
+file_watcher::~file_watcher()
+{
+#ifdef __linux__
+	if (inotify_fd >= 0)
+		close(inotify_fd);
+#endif
+}
+
+string file_watcher::file_path(const watched_directory& directory, const string& name)
+{
+	return directory.path.empty() ? name : (filesystem::path(directory.path) / name).string();
+}
+
+file_watcher::watched_directory& file_watcher::add_directory(const string& path)
+{
+	for (auto& d : directories) {
+		if (d.path == path)
+			return d;
+	}
+	directories.push_back(watched_directory{ path, false, set<string>() });
+#ifdef __linux__
+	int wd = inotify_add_watch(inotify_fd, path.empty() ? "." : path.c_str(), watch_mask);
+	if (wd >= 0)
+		watches[wd] = directories.size() - 1;
+#endif
+	return directories.back();
+}
+
+bool file_watcher::add(const string& path)
+{
+	error_code error;
+	if (filesystem::is_directory(path, error))
+		add_directory(path).whole = true;
+	else if (filesystem::is_regular_file(path, error)) {
+		filesystem::path p(path);
+		add_directory(p.parent_path().string()).names.insert(p.filename().string());
+	}
+	else
+		return false;
+
+#ifndef __linux__
+	// the state to compare with from now on
+	set<string> ignored;
+	scan(ignored);
+#endif
+	return true;
+}
+
+vector<string> file_watcher::files()
+{
+	set<string> result;
+	for (auto& d : directories) {
+		for (auto& name : d.names)
+			result.insert(file_path(d, name));
+		if (!d.whole)
+			continue;
+		error_code error;
+		for (filesystem::directory_iterator it(d.path.empty() ? "." : d.path, error), end; !error && it != end; it.increment(error)) {
+			if (it->is_regular_file(error))
+				result.insert(file_path(d, it->path().filename().string()));
+		}
+	}
+	return vector<string>(result.begin(), result.end());
+}
+
+#ifdef __linux__
+
+vector<string> file_watcher::wait()
+{
+	set<string> changed;
+	if (inotify_fd < 0)
+		return vector<string>();
+
+	// block for the first event, then collect until it is quiet
+	int timeout = -1;
+	alignas(inotify_event) char events[1 << 16];
+	while (true) {
+		pollfd p = { inotify_fd, POLLIN, 0 };
+		int ready = poll(&p, 1, timeout);
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready <= 0)
+			break;
+
+		ssize_t n = read(inotify_fd, events, sizeof(events));
+		if (n <= 0)
+			break;
+		for (char* e = events; e < events + n; ) {
+			inotify_event* event = (inotify_event*)e;
+			e += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				// events were lost, so everything may have changed
+				for (auto& f : files())
+					changed.insert(f);
+				continue;
+			}
+			auto found = watches.find(event->wd);
+			if (found == watches.end() || event->len == 0)
+				continue;
+			watched_directory& d = directories[found->second];
+			string name = event->name;
+			if (d.whole || d.names.count(name) != 0)
+				changed.insert(file_path(d, name));
+		}
+		timeout = settle;
+	}
+	return vector<string>(changed.begin(), changed.end());
+}
+
+#else
+
+// compare modification times and sizes with the last scan
+void file_watcher::scan(set<string>& changed)
+{
+	set<string> seen;
+	for (auto& f : files()) {
+		error_code error;
+		filesystem::file_time_type time = filesystem::last_write_time(f, error);
+		uintmax_t size = filesystem::file_size(f, error);
+		if (error)
+			continue;
+		seen.insert(f);
+		auto found = stamps.find(f);
+		if (found == stamps.end() || found->second.first != time || found->second.second != size) {
+			stamps[f] = make_pair(time, size);
+			changed.insert(f);
+		}
+	}
+	for (auto it = stamps.begin(); it != stamps.end(); ) {
+		if (seen.count(it->first) == 0) {
+			changed.insert(it->first);
+			it = stamps.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+vector<string> file_watcher::wait()
+{
+	set<string> changed;
+	while (changed.empty()) {
+		this_thread::sleep_for(chrono::milliseconds(poll_interval));
+		scan(changed);
+	}
+	// keep looking until a scan finds nothing new
+	size_t count;
+	do {
+		count = changed.size();
+		this_thread::sleep_for(chrono::milliseconds(settle));
+		scan(changed);
+	} while (changed.size() != count);
+	return vector<string>(changed.begin(), changed.end());
+}
+
+#endif
+
+document_set::document_set() : documents(new document_map())
+{
+}
+
+document_set::~document_set()
+{
+	delete documents.load();
+	for (auto m : retired)
+		delete m;
+}
+
+// swap in the changed copy of the map; the maps replaced before go once no
+// reader is in them, and with them the documents of removed files
+void document_set::replace(document_map* changed)
+{
+	retired.push_back(documents.exchange(changed));
+	auto m = retired.begin();
+	while (m != retired.end()) {
+		if (readers.in_use(*m)) {
+			++m;
+			continue;
+		}
+		delete *m;
+		m = retired.erase(m);
+	}
+}
+
+bool document_set::refresh(const string& file_name, list<node_change>& changes)
+{
+	changes.clear();
+	const document_map* current = documents.load();
+	auto found = current->find(file_name);
+	shared_ptr<node> old_root = found != current->end() ? found->second->root : nullptr;
+
+	ifstream in(file_name, ios_base::in | ios_base::binary | ios_base::ate);
+	if (in.fail()) {
+		// the file is gone
+		if (found == current->end())
+			return false;
+		changes = tree_diff(old_root, nullptr).get_changes();
+		document_map* changed = new document_map(*current);
+		changed->erase(file_name);
+		replace(changed);
+		return true;
+	}
+	source.resize((size_t)in.tellg());
+	in.seekg(0);
+	if (!in.read(source.data(), source.size()))
+		return false;
+
+	// the parser points into source and holds all tokens, only the tree is kept
+	shared_ptr<node> root;
+	{
+		token_parser parser(source.data(), source.size());
+		if (!parser.tokenize() || !parser.parse())
+			return false;
+		root = parser.get_root();
+	}
+
+	shared_ptr<document> d = found != current->end() ? found->second : make_shared<document>();
+	changes = tree_diff(old_root, root).get_changes();
+	d->snapshot.publish(tree_snapshot::freeze(root));
+	d->root = root;
+	if (found == current->end()) {
+		// readers find a new file only once it has its first snapshot
+		document_map* changed = new document_map(*current);
+		changed->emplace(file_name, d);
+		replace(changed);
+	}
+	return true;
+}
+
+shared_ptr<const tree_snapshot> document_set::acquire(const string& file_name) const
+{
+	size_t slot;
+	const document_map* current = readers.protect(documents, slot);
+	auto found = current->find(file_name);
+	shared_ptr<const tree_snapshot> snapshot = found != current->end() ? found->second->snapshot.acquire() : nullptr;
+	readers.leave(slot);
+	return snapshot;
+}
@@ -0,0 +1,101 @@
+#ifndef __WATCH_DEFINED__
+#define __WATCH_DEFINED__
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <filesystem>
+
+#include "Tokenizer.h"
+#include "Diff.h"
+#include "Snapshot.h"
+
+using namespace std;
+
+// Watches files and directories for changes. On Linux inotify reports the
+// changes; elsewhere the modification times are polled. A file is watched
+// through its directory, so editors saving by renaming a new file over
+// the old one are seen too. A watched directory covers all files in it,
+// also new ones, but not its subdirectories.
+
+class file_watcher
+{
+private:
+	struct watched_directory
+	{
+		string path;				// as given, "" for the current directory
+		bool whole;					// all files in it, or only those in names
+		set<string> names;
+	};
+	vector<watched_directory> directories;
+	int settle;						// ms without events that end a burst
+#ifdef __linux__
+	int inotify_fd;
+	map<int, size_t> watches;		// watch descriptor => directories index
+#else
+	map<string, pair<filesystem::file_time_type, uintmax_t> > stamps;
+
+	void scan(set<string>& changed);
+#endif
+	watched_directory& add_directory(const string& path);
+	string file_path(const watched_directory& directory, const string& name);
+public:
+	file_watcher(int settle_ms = 5);
+	~file_watcher();
+	file_watcher(const file_watcher&) = delete;
+	file_watcher& operator=(const file_watcher&) = delete;
+
+	// watch a file or a directory, false if it does not exist
+	bool add(const string& path);
+	// the files being watched now
+	vector<string> files();
+	// block until files change; writes following each other within the
+	// settle time are collected into one call. Empty if watching failed.
+	vector<string> wait();
+};
+
+// The parsed trees of a set of files, kept current with refresh() from one
+// thread. Every file has a snapshot_holder, so reader threads can acquire()
+// its tree while it is being refreshed. The map of files is published the
+// same way: adding or removing a file swaps in a changed copy, and readers
+// follow the current map through a hazard slot without taking a lock. The
+// buffer the files are read into is kept from one refresh to the next.
+
+class document_set
+{
+private:
+	struct document
+	{
+		shared_ptr<node> root;		// kept for the diff with the next version
+		snapshot_holder snapshot;
+	};
+	typedef map<string, shared_ptr<document> > document_map;
+
+	atomic<const document_map*> documents;	// replaced as a whole, never changed
+	hazard_slots readers;
+	vector<const document_map*> retired;	// replaced, maybe still read
+	vector<char> source;			// only read during tokenize()
+
+	void replace(document_map* changed);
+public:
+	document_set();
+	~document_set();
+	document_set(const document_set&) = delete;
+	document_set& operator=(const document_set&) = delete;
+
+	// parse the file again, changes tells what differs from the last
+	// version; false if it could not be parsed, the last version stays
+	bool refresh(const string& file_name, list<node_change>& changes);
+	// the current tree of the file, nullptr if it is not known
+	shared_ptr<const tree_snapshot> acquire(const string& file_name) const;
+	// the number of files, for the thread calling refresh()
+	size_t size() { return documents.load()->size(); }
+};
+
+#endif